@@ -5,59 +5,65 @@
 #include <functional>
 #include "point.h"
 
-struct strippedBody {
+template <int D>
+struct basicStrippedBody {
     double mass;
-    point pos;
-    acceleration accel = {{0, 0}, {0, 0}};
-    point velocity = {0, 0};
+    vec<D> pos;
+    basicAcceleration<D> accel = {};
+    vec<D> velocity = {};
     int index;
 };
 
-struct body {
+typedef basicStrippedBody<2> strippedBody;
+
+// a node of a 2^D-tree (quadtree for D = 2, octree for D = 3)
+template <int D>
+struct basicBody {
+    static constexpr int DIMENSIONS = D;
+    static constexpr int CHILDREN = 1 << D;
+
     // TODO: consider using delta to inform whether or not updating the com matters
     static constexpr double DELTA = 0.5;
     static constexpr double G = 4.3009172706e-03; // parsec / solar mass * (km/s) ^ 2
     static constexpr double C = 299792.0; // km/s
 
-    point pos; // if external node, true position of body. otherwise com
-    quad bounds;
+    vec<D> pos; // if external node, true position of body. otherwise com
+    box<D> bounds;
     double mass; // mass of 0 means that it is empty
 
-    /* children order
+    /* children order, bit k of the index picks the upper half along dimension k
     *  ll ---+
     *    0 1 |
     *    2 3 |
     *        ur
+    *  octree children 4 - 7 repeat this in the upper half of z
     */
-    struct body* children[4] = {nullptr};
-    struct body* parent = nullptr;
+    basicBody* children[CHILDREN] = {nullptr};
+    basicBody* parent = nullptr;
 
     int index = -1;
 
     // shush
     bool isLeaf() {
-        return !((children[0] && children[0]->mass > 1e-6) ||
-                 (children[1] && children[1]->mass > 1e-6) ||
-                 (children[2] && children[2]->mass > 1e-6) ||
-                 (children[3] && children[3]->mass > 1e-6));
+        bool inner = false;
+        unroll<CHILDREN>::each([this, &inner] (int i) { inner |= children[i] && children[i]->mass > 1e-6; });
+        return !inner;
     }
-    //bool isLeaf() {return !children[0] && !children[1] && !children[2] && !children[3]; }
 
-    acceleration accel = {{0, 0}, {0, 0}};
-    point velocity = {0, 0};
+    basicAcceleration<D> accel = {};
+    vec<D> velocity = {};
+    double potential = 0; // potential energy from the last force calc (pairs are counted from both sides)
 
-    body* getChild(int ind);
+    basicBody* getChild(int ind);
 
-    double distTo(body* b) {
-        return std::sqrt((b->pos.x - pos.x) * (b->pos.x - pos.x) +
-                         (b->pos.y - pos.y) * (b->pos.y - pos.y));
+    double distTo(basicBody* b) {
+        double d2 = 0;
+        unroll<D>::each([this, b, &d2] (int k) { d2 += (b->pos[k] - pos[k]) * (b->pos[k] - pos[k]); });
+        return std::sqrt(d2);
     }
 
-    void applyForceFrom(body* b, double d);
-    void applyForceFrom(body* b) { applyForceFrom(b, distTo(b)); }
-
-    strippedBody strip() { return {mass, pos, accel, velocity, index}; }
-    void update(strippedBody sb) {
+    basicStrippedBody<D> strip() { return {mass, pos, accel, velocity, index}; }
+    void update(basicStrippedBody<D> sb) {
         mass = sb.mass;
         pos = sb.pos;
         accel = sb.accel;
@@ -65,12 +71,24 @@ struct body {
         index = sb.index;
     }
 
-    void incrementCoM(point p, double m);
-    void decrementCoM(point p, double m);
-    void moveCoM(point delta, double m);
+    void incrementCoM(vec<D> p, double m);
+    void decrementCoM(vec<D> p, double m);
+    void moveCoM(vec<D> delta, double m);
 
-    void notifyChildRemoval(point p, double m, const std::function<bool(body*)>& condition);
-    void notifyChildMovement(point delta, double m, const std::function<bool(body*)>& condition);
+    void notifyChildRemoval(vec<D> p, double m, const std::function<bool(basicBody*)>& condition);
+    void notifyChildMovement(vec<D> delta, double m, const std::function<bool(basicBody*)>& condition);
 };
 
+template <int D> constexpr int basicBody<D>::DIMENSIONS;
+template <int D> constexpr int basicBody<D>::CHILDREN;
+template <int D> constexpr double basicBody<D>::DELTA;
+template <int D> constexpr double basicBody<D>::G;
+template <int D> constexpr double basicBody<D>::C;
+
+// everything is compiled once per dimension in body.cpp
+extern template struct basicBody<2>;
+extern template struct basicBody<3>;
+
+typedef basicBody<2> body;
+
 #endif
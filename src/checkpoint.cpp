@@ -0,0 +1,93 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include "checkpoint.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr char checkpointHeader::MAGIC[8];
+
+#ifdef _WIN32
+mappedFile::mappedFile(const std::string& path) {
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return;
+    file = f;
+
+    LARGE_INTEGER s;
+    if (!GetFileSizeEx(f, &s) || s.QuadPart == 0) return;
+
+    mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) return;
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data) length = (size_t) s.QuadPart;
+}
+
+mappedFile::~mappedFile() {
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+}
+#else
+mappedFile::mappedFile(const std::string& path) {
+    file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return;
+
+    struct stat s;
+    if (fstat(file, &s) != 0 || s.st_size == 0) return;
+
+    void* p = mmap(nullptr, (size_t) s.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (p == MAP_FAILED) return;
+
+    // records are read front to back exactly once
+    madvise(p, (size_t) s.st_size, MADV_SEQUENTIAL);
+    data = p;
+    length = (size_t) s.st_size;
+}
+
+mappedFile::~mappedFile() {
+    if (data) munmap(const_cast<void*>(data), length);
+    if (file >= 0) close(file);
+}
+#endif
+
+void checkpointWriter::write(const std::string& path, checkpointHeader header, std::vector<strippedBody>&& bodies) {
+    wait();
+    worker = std::thread(_write, path, header, std::move(bodies));
+}
+
+void checkpointWriter::_write(std::string path, checkpointHeader header, std::vector<strippedBody> bodies) {
+    // write next to the target and swap it in at the end so a crash mid write never leaves a broken checkpoint
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "WARN: Unable to open " << tmp << " for checkpointing." << std::endl;
+        return;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(bodies.data()), (std::streamsize) (bodies.size() * sizeof(strippedBody)));
+    out.close();
+
+    if (!out) {
+        std::cout << "WARN: Failed to write checkpoint " << tmp << std::endl;
+        return;
+    }
+
+#ifdef _WIN32
+    bool moved = MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool moved = std::rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!moved) std::cout << "WARN: Failed to replace checkpoint " << path << std::endl;
+}
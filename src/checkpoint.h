@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include "body.h"
+#include "point.h"
+
+/*
+* FILE LAYOUT
+* checkpointHeader (64 bytes)
+* strippedBody * count
+*
+* records are stored exactly as they are in memory so that loading can read them straight out of the mapped file
+*/
+
+static_assert(sizeof(strippedBody) == 80, "strippedBody layout changed, bump CHECKPOINT_VERSION");
+
+struct checkpointHeader {
+    static constexpr char MAGIC[8] = {'B', 'H', 'C', 'K', 'P', 'T', 0, 0};
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    int64_t bodyIndex; // next index to hand out, so new stars dont collide with restored ones
+    quad bounds; // root bounds
+};
+
+static_assert(sizeof(checkpointHeader) == 64, "checkpointHeader must stay 64 bytes");
+
+// read only view of a whole file
+class mappedFile {
+private:
+    const void* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int file = -1;
+#endif
+public:
+    mappedFile(const std::string& path);
+    ~mappedFile();
+
+    bool valid() { return data != nullptr; }
+    const void* get() { return data; }
+    size_t size() { return length; }
+
+    mappedFile(mappedFile const&) = delete;
+    mappedFile& operator=(const mappedFile&) = delete;
+};
+
+// writes checkpoints on a background thread, only one write is in flight at a time
+class checkpointWriter {
+private:
+    std::thread worker;
+
+    static void _write(std::string path, checkpointHeader header, std::vector<strippedBody> bodies);
+public:
+    // takes ownership of bodies, blocks only if the previous checkpoint is still being written
+    void write(const std::string& path, checkpointHeader header, std::vector<strippedBody>&& bodies);
+    void wait() { if (worker.joinable()) worker.join(); }
+
+    checkpointWriter() {}
+    checkpointWriter(checkpointWriter const&) = delete;
+    checkpointWriter& operator=(const checkpointWriter&) = delete;
+
+    ~checkpointWriter() { wait(); }
+};
+
+#endif
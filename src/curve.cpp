@@ -0,0 +1,33 @@
+#include <algorithm>
+#include "curve.h"
+
+uint64_t hilbertKey(point p, const quad& domain) {
+    // grid coordinates in [0, 2^32)
+    uint32_t c[2];
+    for (int k = 0; k < 2; k++) {
+        double extent = domain.ur[k] - domain.ll[k];
+        double t = (extent > 0) ? (p[k] - domain.ll[k]) / extent : 0;
+        t = std::min(std::max(t, 0.0), 1.0);
+        c[k] = (uint32_t) std::min(t * 4294967296.0, 4294967295.0);
+    }
+
+    // https://en.wikipedia.org/wiki/Hilbert_curve#Applications_and_mapping_algorithms
+    uint32_t x = c[0], y = c[1];
+    uint64_t d = 0;
+    for (uint32_t s = 1u << 31; s > 0; s >>= 1) {
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += (uint64_t) s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so the curve inside it has the right orientation
+        if (ry == 0) {
+            if (rx == 1) {
+                x = ~x;
+                y = ~y;
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return d;
+}
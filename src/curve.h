@@ -0,0 +1,11 @@
+#ifndef CURVE_H
+#define CURVE_H
+
+#include <cstdint>
+#include "point.h"
+
+// position of p along a hilbert curve filling domain, points close on the curve are close in space
+// p is clamped to domain, 32 bits per axis
+uint64_t hilbertKey(point p, const quad& domain);
+
+#endif
@@ -0,0 +1,63 @@
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include "direct.h"
+#include "body.h"
+
+// number of sources held in cache while sweeping a range of targets
+static constexpr size_t BLOCK = 512;
+
+template <int D>
+static void _directForces(const std::vector<vec<D>>& pos, const std::vector<double>& mass, std::vector<vec<D>>& accel,
+                          double period, const ewaldTable<D>* ewald, size_t start, size_t end) {
+    for (size_t j0 = 0; j0 < pos.size(); j0 += BLOCK) {
+        size_t j1 = std::min(j0 + BLOCK, pos.size());
+
+        for (size_t i = start; i < end; i++) {
+            vec<D> a = {};
+            for (size_t j = j0; j < j1; j++) {
+                vec<D> d;
+                double r2 = 0;
+                unroll<D>::each([&] (int k) {
+                    d[k] = pos[j][k] - pos[i][k];
+                    if (period > 0) d[k] -= period * std::round(d[k] / period);
+                    r2 += d[k] * d[k];
+                });
+                // also skips self
+                if (r2 == 0) continue;
+
+                double inv = mass[j] / (r2 * std::sqrt(r2));
+                unroll<D>::each([&] (int k) { a[k] += d[k] * inv; });
+
+                if (ewald) {
+                    vec<D> c = {};
+                    double phi = 0;
+                    ewald->correct(d, period, c, phi);
+                    unroll<D>::each([&] (int k) { a[k] += mass[j] * c[k]; });
+                }
+            }
+
+            unroll<D>::each([&] (int k) { accel[i][k] += body::G * a[k]; });
+        }
+    }
+}
+
+template <int D>
+void directForces(const std::vector<vec<D>>& pos, const std::vector<double>& mass, std::vector<vec<D>>& accel,
+                  double period, const ewaldTable<D>* ewald) {
+    accel.assign(pos.size(), vec<D>{});
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk = (pos.size() + threads - 1) / threads;
+
+    std::vector<std::thread> workers;
+    for (size_t start = 0; start < pos.size(); start += chunk) {
+        size_t end = std::min(start + chunk, pos.size());
+        workers.emplace_back(_directForces<D>, std::cref(pos), std::cref(mass), std::ref(accel), period, ewald, start, end);
+    }
+
+    for (auto& w : workers) w.join();
+}
+
+template void directForces<2>(const std::vector<vec<2>>&, const std::vector<double>&, std::vector<vec<2>>&, double, const ewaldTable<2>*);
+template void directForces<3>(const std::vector<vec<3>>&, const std::vector<double>&, std::vector<vec<3>>&, double, const ewaldTable<3>*);
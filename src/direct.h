@@ -0,0 +1,19 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <vector>
+#include "point.h"
+#include "ewald.h"
+
+// exact O(n^2) accelerations, used as ground truth when checking the tree
+// pos and mass must be the same length, accel is resized to match
+// with a period every pair is taken at its nearest image plus the table's correction for the others, the same way the
+// tree walk does it, so the comparison only measures the error of the tree
+template <int D>
+void directForces(const std::vector<vec<D>>& pos, const std::vector<double>& mass, std::vector<vec<D>>& accel,
+                  double period = 0, const ewaldTable<D>* ewald = nullptr);
+
+extern template void directForces<2>(const std::vector<vec<2>>&, const std::vector<double>&, std::vector<vec<2>>&, double, const ewaldTable<2>*);
+extern template void directForces<3>(const std::vector<vec<3>>&, const std::vector<double>&, std::vector<vec<3>>&, double, const ewaldTable<3>*);
+
+#endif
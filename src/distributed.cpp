@@ -0,0 +1,165 @@
+#include "distributed.h"
+
+#ifdef USE_MPI
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include "curve.h"
+
+distributedUniverse::distributedUniverse(Universe& local, MPI_Comm comm) : local(local), comm(comm) {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &ranks);
+
+    histogram.resize((size_t) 1 << BUCKET_BITS);
+    splitters.assign(ranks + 1, 0);
+    splitters[ranks] = std::numeric_limits<uint64_t>::max();
+}
+
+int distributedUniverse::owner(uint64_t key) const {
+    // number of interior splitters at or below key
+    return (int) (std::upper_bound(splitters.begin() + 1, splitters.begin() + ranks, key) - (splitters.begin() + 1));
+}
+
+template <typename T>
+std::vector<T> distributedUniverse::exchange(const std::vector<std::vector<T>>& outgoing) {
+    // everything is sent as bytes, T is plain data
+    std::vector<int> sendCounts(ranks), sendOffsets(ranks), recvCounts(ranks), recvOffsets(ranks);
+    int sendTotal = 0;
+    for (int r = 0; r < ranks; r++) {
+        sendCounts[r] = (int) (outgoing[r].size() * sizeof(T));
+        sendOffsets[r] = sendTotal;
+        sendTotal += sendCounts[r];
+    }
+    MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, comm);
+
+    int recvTotal = 0;
+    for (int r = 0; r < ranks; r++) {
+        recvOffsets[r] = recvTotal;
+        recvTotal += recvCounts[r];
+    }
+
+    std::vector<unsigned char> send(sendTotal);
+    for (int r = 0; r < ranks; r++) {
+        if (sendCounts[r]) std::memcpy(send.data() + sendOffsets[r], outgoing[r].data(), sendCounts[r]);
+    }
+
+    std::vector<T> received(recvTotal / sizeof(T));
+    MPI_Alltoallv(send.data(), sendCounts.data(), sendOffsets.data(), MPI_BYTE,
+                  received.data(), recvCounts.data(), recvOffsets.data(), MPI_BYTE, comm);
+
+    return received;
+}
+
+void distributedUniverse::decompose() {
+    std::vector<strippedBody> bodies;
+    local.exportBodies(bodies);
+
+    // common bounding box, max is reduced as -min so it all fits in one call
+    double extent[4] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                        std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    for (const strippedBody& sb : bodies) {
+        extent[0] = std::min(extent[0], sb.pos.x);
+        extent[1] = std::min(extent[1], sb.pos.y);
+        extent[2] = std::min(extent[2], -sb.pos.x);
+        extent[3] = std::min(extent[3], -sb.pos.y);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, extent, 4, MPI_DOUBLE, MPI_MIN, comm);
+    if (extent[0] > -extent[2]) return; // nothing anywhere
+
+    domain = {{extent[0], extent[1]}, {-extent[2], -extent[3]}};
+
+    // global histogram of the curve weighted by what the force walk of every body has been costing,
+    // then cut it into runs of equal work (bodies that havent been measured count as the cheapest walk)
+    std::fill(histogram.begin(), histogram.end(), 0.0);
+    for (const strippedBody& sb : bodies) {
+        histogram[hilbertKey(sb.pos, domain) >> (64 - BUCKET_BITS)] += std::max(local.work(sb.index), 1.0);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, histogram.data(), (int) histogram.size(), MPI_DOUBLE, MPI_SUM, comm);
+
+    double total = 0;
+    for (double h : histogram) total += h;
+
+    double running = 0;
+    int next = 1;
+    for (size_t b = 0; b < histogram.size() && next < ranks; b++) {
+        running += histogram[b];
+        while (next < ranks && running >= total * next / ranks) {
+            splitters[next++] = (b + 1 == histogram.size()) ? std::numeric_limits<uint64_t>::max()
+                                                             : (uint64_t) (b + 1) << (64 - BUCKET_BITS);
+        }
+    }
+    while (next < ranks) splitters[next++] = std::numeric_limits<uint64_t>::max();
+
+    // migrate whatever is now owned by someone else
+    std::vector<strippedBody> leaving = local.releaseStars([this] (const strippedBody& sb) {
+        return owner(hilbertKey(sb.pos, domain)) != rank;
+    });
+
+    // the measured work goes along so the new owner can balance with it straight away
+    std::vector<std::vector<migrant>> outgoing(ranks);
+    for (const strippedBody& sb : leaving) outgoing[owner(hilbertKey(sb.pos, domain))].push_back({sb, (float) local.work(sb.index)});
+
+    std::vector<migrant> arrived = exchange(outgoing);
+    std::vector<strippedBody> stars(arrived.size());
+    std::vector<float> work(arrived.size());
+    for (size_t i = 0; i < arrived.size(); i++) {
+        stars[i] = arrived[i].star;
+        work[i] = arrived[i].work;
+    }
+    local.adoptStars(stars, work);
+}
+
+void distributedUniverse::step() {
+    decompose();
+
+    // every rank needs the region every other rank owns
+    std::vector<strippedBody> bodies;
+    local.exportBodies(bodies);
+
+    double region[4] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                        std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    for (const strippedBody& sb : bodies) {
+        region[0] = std::min(region[0], sb.pos.x);
+        region[1] = std::min(region[1], sb.pos.y);
+        region[2] = std::max(region[2], sb.pos.x);
+        region[3] = std::max(region[3], sb.pos.y);
+    }
+
+    std::vector<double> regions(4 * ranks);
+    MPI_Allgather(region, 4, MPI_DOUBLE, regions.data(), 4, MPI_DOUBLE, comm);
+
+    std::vector<std::vector<pointMass>> outgoing(ranks);
+    for (int r = 0; r < ranks; r++) {
+        const double* q = &regions[4 * r];
+        if (r == rank || q[0] > q[2]) continue; // self or empty
+
+        local.essentialNodes({{q[0], q[1]}, {q[2], q[3]}}, outgoing[r]);
+    }
+    local.setExternalMasses(exchange(outgoing));
+
+    local.step();
+}
+
+size_t distributedUniverse::count() {
+    std::vector<strippedBody> bodies;
+    local.exportBodies(bodies);
+
+    unsigned long long n = bodies.size();
+    MPI_Allreduce(MPI_IN_PLACE, &n, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+    return (size_t) n;
+}
+
+conservedQuantities distributedUniverse::conserved() {
+    conservedQuantities c = local.conserved;
+    double sums[5] = {c.kinetic, c.potential, c.momentum.x, c.momentum.y, c.angularMomentum};
+    MPI_Allreduce(MPI_IN_PLACE, sums, 5, MPI_DOUBLE, MPI_SUM, comm);
+
+    c.kinetic = sums[0];
+    c.potential = sums[1];
+    c.momentum = {sums[2], sums[3]};
+    c.angularMomentum = sums[4];
+    return c;
+}
+
+#endif
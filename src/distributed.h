@@ -0,0 +1,61 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// only built with USE_MPI defined (and an mpi implementation to link against)
+#ifdef USE_MPI
+
+#include <mpi.h>
+#include <cstdint>
+#include <vector>
+#include "universe.h"
+
+// one rank's share of a simulation spread over mpi ranks, run with e.g. mpirun -np 4 barnes-hut --distributed
+// bodies are split into contiguous runs of a hilbert curve over their common bounding box, so every rank owns a compact
+// region, and the runs are cut so every rank gets about the same measured force walk work (see Universe::work)
+// other ranks are only seen through their locally essential tree (the nodes that pass the opening test from anywhere
+// in this rank's region), exchanged before every step
+// the remote pull is held fixed for the whole step so the extra force evaluations of 4th order integrators only
+// refresh the local part, the domain is always open (no periodic images between ranks) and collisions stay per rank
+class distributedUniverse {
+private:
+    static constexpr int BUCKET_BITS = 16; // splitters are placed between the top BUCKET_BITS of the curve keys
+
+    struct migrant {
+        strippedBody star;
+        float work;
+    };
+
+    Universe& local;
+    MPI_Comm comm;
+    int rank, ranks;
+
+    quad domain; // bounding box of every body, the curve is laid over this
+    std::vector<double> histogram;
+    std::vector<uint64_t> splitters; // rank r owns keys in [splitters[r], splitters[r + 1])
+
+    int owner(uint64_t key) const;
+
+    // sends outgoing[r] to rank r, returns everything this rank was sent
+    template <typename T>
+    std::vector<T> exchange(const std::vector<std::vector<T>>& outgoing);
+public:
+    // every rank passes its own universe, bodies can start on any rank (e.g. all on rank 0)
+    distributedUniverse(Universe& local, MPI_Comm comm = MPI_COMM_WORLD);
+
+    // repartitions along the curve and moves every body to the rank that now owns it
+    void decompose();
+    // decompose, exchange essential trees and step the local universe
+    void step();
+
+    // totals over every rank, these are collective so every rank has to call them
+    size_t count();
+    // needs trackConserved on every rank
+    conservedQuantities conserved();
+
+    distributedUniverse(distributedUniverse const&) = delete;
+    distributedUniverse& operator=(const distributedUniverse&) = delete;
+};
+
+#endif
+
+#endif
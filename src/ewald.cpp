@@ -0,0 +1,149 @@
+#include <cmath>
+#include <algorithm>
+#include "ewald.h"
+
+static const double PI = 3.14159265358979323846;
+
+// splitting between the real and reciprocal sums for a unit box, both have converged well within the ranges below
+static const double ALPHA = 2.0;
+static const int REAL_RANGE = 3;
+static const int RECIPROCAL_RANGE = 4;
+
+// reciprocal space potential per unit cos(k.d) of wavenumber k, and the k = 0 term
+// in 2d the images only repeat in the plane, so this is the sheet (parry) form evaluated in the plane
+template <int D> static double reciprocal(double k);
+template <int D> static double background();
+
+template <> double reciprocal<2>(double k) { return 2 * PI * std::erfc(k / (2 * ALPHA)) / k; }
+template <> double reciprocal<3>(double k) { return 4 * PI * std::exp(-k * k / (4 * ALPHA * ALPHA)) / (k * k); }
+template <> double background<2>() { return -2 * std::sqrt(PI) / ALPHA; }
+template <> double background<3>() { return -PI / (ALPHA * ALPHA); }
+
+// calls f with every integer vector in [-range, range]^D
+template <int D, typename F>
+static void lattice(int range, F f) {
+    int side = 2 * range + 1;
+    int count = 1;
+    for (int k = 0; k < D; k++) count *= side;
+
+    for (int c = 0; c < count; c++) {
+        int n[D];
+        int rest = c;
+        for (int k = 0; k < D; k++) {
+            n[k] = rest % side - range;
+            rest /= side;
+        }
+        f(n);
+    }
+}
+
+template <int D>
+typename ewaldTable<D>::entry ewaldTable<D>::exact(const vec<D>& d) {
+    entry e = {};
+
+    // nearest image, only what the screening takes away from it is left
+    double s2 = 0;
+    unroll<D>::each([&] (int k) { s2 += d[k] * d[k]; });
+    double s = std::sqrt(s2);
+    if (ALPHA * s < 1e-4) {
+        // limits for s -> 0
+        unroll<D>::each([&] (int k) { e.accel[k] = -d[k] * 4 * ALPHA * ALPHA * ALPHA / (3 * std::sqrt(PI)); });
+        e.potential = -2 * ALPHA / std::sqrt(PI);
+    } else {
+        double screened = std::erf(ALPHA * s) - 2 * ALPHA * s / std::sqrt(PI) * std::exp(-ALPHA * ALPHA * s2);
+        unroll<D>::each([&] (int k) { e.accel[k] = -d[k] * screened / (s2 * s); });
+        e.potential = -std::erf(ALPHA * s) / s;
+    }
+
+    // every other image, short range part
+    lattice<D>(REAL_RANGE, [&] (const int* n) {
+        bool nearest = true;
+        unroll<D>::each([&] (int k) { nearest &= n[k] == 0; });
+        if (nearest) return;
+
+        double r[D];
+        double r2 = 0;
+        unroll<D>::each([&] (int k) {
+            r[k] = d[k] + n[k];
+            r2 += r[k] * r[k];
+        });
+        double r1 = std::sqrt(r2);
+        double screened = std::erfc(ALPHA * r1) + 2 * ALPHA * r1 / std::sqrt(PI) * std::exp(-ALPHA * ALPHA * r2);
+
+        unroll<D>::each([&] (int k) { e.accel[k] += r[k] * screened / (r2 * r1); });
+        e.potential += std::erfc(ALPHA * r1) / r1;
+    });
+
+    // long range part
+    lattice<D>(RECIPROCAL_RANGE, [&] (const int* m) {
+        double kv[D];
+        double k2 = 0, kd = 0;
+        unroll<D>::each([&] (int k) {
+            kv[k] = 2 * PI * m[k];
+            k2 += kv[k] * kv[k];
+            kd += kv[k] * d[k];
+        });
+        if (k2 == 0) return;
+
+        double w = reciprocal<D>(std::sqrt(k2));
+        unroll<D>::each([&] (int k) { e.accel[k] += w * kv[k] * std::sin(kd); });
+        e.potential += w * std::cos(kd);
+    });
+
+    e.potential += background<D>();
+    return e;
+}
+
+template <int D>
+void ewaldTable<D>::build() {
+    int side = CELLS + 1;
+    int count = 1;
+    for (int k = 0; k < D; k++) count *= side;
+
+    table.resize(count);
+    for (int c = 0; c < count; c++) {
+        vec<D> d;
+        int rest = c;
+        for (int k = 0; k < D; k++) {
+            d[k] = (rest % side) / (2.0 * CELLS);
+            rest /= side;
+        }
+        table[c] = exact(d);
+    }
+}
+
+template <int D>
+void ewaldTable<D>::correct(const vec<D>& d, double size, vec<D>& accel, double& potential) const {
+    // multilinear interpolation between the 2^D surrounding entries
+    int cell[D];
+    double frac[D];
+    unroll<D>::each([&] (int k) {
+        double g = std::min(std::fabs(d[k]) / size * 2 * CELLS, (double) CELLS);
+        cell[k] = std::min((int) g, CELLS - 1);
+        frac[k] = g - cell[k];
+    });
+
+    double a[D] = {};
+    double phi = 0;
+    unroll<(1 << D)>::each([&] (int corner) {
+        double w = 1;
+        int at = 0, stride = 1;
+        unroll<D>::each([&] (int k) {
+            int up = (corner >> k) & 1;
+            w *= up ? frac[k] : 1 - frac[k];
+            at += (cell[k] + up) * stride;
+            stride *= CELLS + 1;
+        });
+
+        const entry& e = table[at];
+        unroll<D>::each([&] (int k) { a[k] += w * e.accel[k]; });
+        phi += w * e.potential;
+    });
+
+    // the table is for a unit box and non negative separations
+    unroll<D>::each([&] (int k) { accel[k] += ((d[k] < 0) ? -a[k] : a[k]) / (size * size); });
+    potential -= phi / size;
+}
+
+template class ewaldTable<2>;
+template class ewaldTable<3>;
@@ -0,0 +1,38 @@
+#ifndef EWALD_H
+#define EWALD_H
+
+#include <vector>
+#include "point.h"
+
+// difference between the pull of every periodic image of a body and the pull of only its nearest image
+// tabulated once for a unit box, the box repeats along every axis (in 2d that makes a periodic sheet, force is still 1 / r^2)
+template <int D>
+class ewaldTable {
+private:
+    static constexpr int CELLS = (D == 2) ? 64 : 32; // table intervals per axis over half the box
+
+    struct entry {
+        double accel[D];
+        double potential;
+    };
+
+    // (CELLS + 1)^D entries covering separations in [0, 1/2]^D, the correction is odd in every component
+    std::vector<entry> table;
+
+    // summed in real and reciprocal space
+    static entry exact(const vec<D>& d);
+public:
+    void build();
+    bool empty() const { return table.empty(); }
+
+    // d is the nearest image separation (source - target) in a box of width size
+    // adds the correction for a source with gm = 1 to accel and potential (which has the sign of -gm / r)
+    void correct(const vec<D>& d, double size, vec<D>& accel, double& potential) const;
+};
+
+template <int D> constexpr int ewaldTable<D>::CELLS;
+
+extern template class ewaldTable<2>;
+extern template class ewaldTable<3>;
+
+#endif
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "exporter.h"
+
+static std::vector<uint32_t> crcTable() {
+    std::vector<uint32_t> table(256);
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+
+    return table;
+}
+
+static uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0) {
+    static const std::vector<uint32_t> table = crcTable();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void appendBE(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back((unsigned char) (v >> 24));
+    out.push_back((unsigned char) (v >> 16));
+    out.push_back((unsigned char) (v >> 8));
+    out.push_back((unsigned char) v);
+}
+
+// length, type, data, crc over type + data
+static void writeChunk(std::ofstream& out, const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> chunk;
+    appendBE(chunk, (uint32_t) data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    appendBE(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+
+    out.write(reinterpret_cast<const char*>(chunk.data()), (std::streamsize) chunk.size());
+}
+
+static void writePNG(std::ofstream& out, const unsigned char* rgb, int width, int height) {
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<unsigned char> header;
+    appendBE(header, (uint32_t) width);
+    appendBE(header, (uint32_t) height);
+    header.push_back(8); // bit depth
+    header.push_back(2); // rgb
+    header.push_back(0); // deflate
+    header.push_back(0); // no filtering
+    header.push_back(0); // not interlaced
+    writeChunk(out, "IHDR", header);
+
+    // every row is prefixed with filter type 0
+    size_t stride = 3 * (size_t) width;
+    std::vector<unsigned char> raw;
+    raw.reserve((stride + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + y * stride, rgb + (y + 1) * stride);
+    }
+
+    // zlib stream made of stored deflate blocks
+    std::vector<unsigned char> z = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i += 65535) {
+        uint16_t len = (uint16_t) std::min<size_t>(65535, raw.size() - i);
+        z.push_back(i + len >= raw.size() ? 1 : 0);
+        z.push_back((unsigned char) len);
+        z.push_back((unsigned char) (len >> 8));
+        z.push_back((unsigned char) ~len);
+        z.push_back((unsigned char) (~len >> 8));
+        z.insert(z.end(), raw.begin() + i, raw.begin() + i + len);
+
+        for (size_t k = i; k < i + len; k++) {
+            a = (a + raw[k]) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    appendBE(z, (b << 16) | a);
+    writeChunk(out, "IDAT", z);
+
+    writeChunk(out, "IEND", {});
+}
+
+frameExporter::frameExporter(const std::string& prefix, format type, size_t capacity)
+    : prefix(prefix), type(type), capacity(std::max<size_t>(1, capacity)) {
+    worker = std::thread(&frameExporter::_run, this);
+}
+
+frameExporter::~frameExporter() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+    signal.notify_all();
+
+    // finishes everything still queued
+    worker.join();
+}
+
+void frameExporter::push(const unsigned char* rgb, int width, int height) {
+    std::unique_lock<std::mutex> l(lock);
+    // backpressure, a slow encoder slows the caller down instead of piling up frames
+    signal.wait(l, [this] { return queue.size() < capacity; });
+
+    std::vector<unsigned char> pixels;
+    if (!pool.empty()) {
+        pixels.swap(pool.back());
+        pool.pop_back();
+    }
+    l.unlock();
+
+    pixels.assign(rgb, rgb + 3 * (size_t) width * height);
+
+    l.lock();
+    queue.push_back({std::move(pixels), width, height, count++});
+    l.unlock();
+    signal.notify_all();
+}
+
+void frameExporter::_run() {
+    while (true) {
+        job j;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            signal.wait(l, [this] { return !queue.empty() || stopping; });
+            if (queue.empty()) return;
+
+            j = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        if (!_write(j)) std::cout << "WARN: Failed to export frame " << j.frame << std::endl;
+
+        {
+            std::lock_guard<std::mutex> l(lock);
+            pool.push_back(std::move(j.pixels));
+        }
+        signal.notify_all();
+    }
+}
+
+bool frameExporter::_write(job& j) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "%06llu", (unsigned long long) j.frame);
+    std::string path = prefix + number + (type == PNG ? ".png" : ".ppm");
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    if (type == PNG) writePNG(out, j.pixels.data(), j.width, j.height);
+    else {
+        out << "P6\n" << j.width << " " << j.height << "\n255\n";
+        out.write(reinterpret_cast<const char*>(j.pixels.data()), (std::streamsize) j.pixels.size());
+    }
+
+    return (bool) out;
+}
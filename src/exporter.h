@@ -0,0 +1,55 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// writes rgb frames to numbered image files from a background encoder thread
+// only needs the raw pixels, so it works without a window or gl context
+class frameExporter {
+public:
+    enum format {
+        PPM, // binary P6
+        PNG // uncompressed deflate, larger than a real encoder but needs no dependencies
+    };
+private:
+    struct job {
+        std::vector<unsigned char> pixels;
+        int width, height;
+        uint64_t frame;
+    };
+
+    std::string prefix;
+    format type;
+    size_t capacity;
+
+    std::deque<job> queue;
+    std::vector<std::vector<unsigned char>> pool; // buffers from finished jobs, reused so memory stays bounded
+    bool stopping = false;
+
+    std::mutex lock;
+    std::condition_variable signal;
+    std::thread worker;
+
+    uint64_t count = 0;
+
+    void _run();
+    bool _write(job& j);
+public:
+    // files are named prefix + zero padded frame number + extension
+    frameExporter(const std::string& prefix, format type = PNG, size_t capacity = 4);
+    ~frameExporter();
+
+    // copies rgb (width * height * 3 bytes), blocks while capacity frames are already waiting
+    void push(const unsigned char* rgb, int width, int height);
+
+    frameExporter(frameExporter const&) = delete;
+    frameExporter& operator=(const frameExporter&) = delete;
+};
+
+#endif
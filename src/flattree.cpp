@@ -0,0 +1,252 @@
+#include <cmath>
+#include "flattree.h"
+#include "scheduler.h"
+
+template <int D, typename P>
+void flatTree<D, P>::build(basicBody<D>* root, bool withVelocities) {
+    scratch.nodes.clear();
+    scratch.centres.clear();
+    scratch.velocities.clear();
+    scratch.parents.clear();
+    if (!root || root->mass == 0) {
+        nodes.clear();
+        motions.clear();
+        return;
+    }
+
+    double mass;
+    _flatten(root, 0, mass, scratch, 0);
+    nodes.swap(scratch.nodes);
+
+    std::vector<vec<D>>& centres = scratch.centres;
+    const std::vector<uint32_t>& parents = scratch.parents;
+
+    // second pass top down, children are placed relative to what the walk will reconstruct for their parent
+    // so rounding doesnt build up with depth
+    rootPos = centres[0];
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        const vec<D>& parentPos = (i == 0) ? rootPos : centres[parents[i]];
+        vec<D> recon;
+        unroll<D>::each([&] (int k) {
+            nodes[i].offset[k] = (storage) (centres[i][k] - parentPos[k]);
+            recon[k] = parentPos[k] + (double) nodes[i].offset[k];
+        });
+
+        // parents always come before their children, so they have already been replaced
+        centres[i] = recon;
+    }
+
+    motions.resize(withVelocities ? nodes.size() : 0);
+    for (size_t i = 0; i < motions.size(); i++) {
+        unroll<D>::each([&] (int k) { motions[i].velocity[k] = (storage) scratch.velocities[i][k]; });
+    }
+}
+
+template <int D, typename P>
+void flatTree<D, P>::_flatten(basicBody<D>* b, uint32_t parent, double& mass, buffer& out, int depth) {
+    uint32_t at = (uint32_t) out.nodes.size();
+    out.nodes.push_back({});
+    out.centres.push_back({});
+    out.velocities.push_back({});
+    out.parents.push_back(parent);
+
+    out.nodes[at].size = (float) (b->bounds.ur[0] - b->bounds.ll[0]);
+
+    if (b->isLeaf()) {
+        out.nodes[at].index = b->index;
+        mass = b->mass;
+        out.centres[at] = b->pos;
+        out.velocities[at] = b->velocity;
+    } else {
+        out.nodes[at].index = -1;
+
+        // mass weighted sums of the children
+        mass = 0;
+        vec<D> moment = {};
+        vec<D> momentum = {};
+        auto add = [&] (uint32_t child, double m) {
+            mass += m;
+            unroll<D>::each([&] (int k) {
+                moment[k] += m * out.centres[child][k];
+                momentum[k] += m * out.velocities[child][k];
+            });
+        };
+
+        scheduler& pool = scheduler::shared();
+        if (depth < SPAWN_DEPTH && pool.size() > 1) {
+            // every child subtree on its own, appended in child order so the layout is the same as flattening in place
+            buffer parts[basicBody<D>::CHILDREN];
+            double masses[basicBody<D>::CHILDREN] = {};
+            scheduler::group g;
+            for (int i = 0; i < basicBody<D>::CHILDREN; i++) {
+                basicBody<D>* c = b->children[i];
+                if (!c || c->mass == 0) continue;
+
+                pool.spawn(g, [c, i, depth, &parts, &masses] { _flatten(c, 0, masses[i], parts[i], depth + 1); });
+            }
+            pool.wait(g);
+
+            for (int i = 0; i < basicBody<D>::CHILDREN; i++) {
+                if (parts[i].nodes.empty()) continue;
+
+                uint32_t child = (uint32_t) out.nodes.size();
+                _append(out, parts[i], at);
+                add(child, masses[i]);
+            }
+        } else {
+            unroll<basicBody<D>::CHILDREN>::each([&] (int i) {
+                basicBody<D>* c = b->children[i];
+                if (!c || c->mass == 0) return;
+
+                uint32_t child = (uint32_t) out.nodes.size();
+                double m;
+                _flatten(c, at, m, out, depth + 1);
+                add(child, m);
+            });
+        }
+
+        if (mass > 0) {
+            unroll<D>::each([&] (int k) {
+                out.centres[at][k] = moment[k] / mass;
+                out.velocities[at][k] = momentum[k] / mass;
+            });
+        } else {
+            out.centres[at] = b->pos;
+        }
+    }
+
+    out.nodes[at].mass = (storage) mass;
+    out.nodes[at].next = (uint32_t) out.nodes.size();
+}
+
+template <int D, typename P>
+void flatTree<D, P>::_append(buffer& into, buffer& from, uint32_t parent) {
+    // from was flattened on its own, so every index in it is shifted by where it lands
+    uint32_t offset = (uint32_t) into.nodes.size();
+    for (size_t i = 0; i < from.nodes.size(); i++) {
+        node n = from.nodes[i];
+        n.next += offset;
+        into.nodes.push_back(n);
+        into.parents.push_back((i == 0) ? parent : from.parents[i] + offset);
+    }
+
+    into.centres.insert(into.centres.end(), from.centres.begin(), from.centres.end());
+    into.velocities.insert(into.velocities.end(), from.velocities.begin(), from.velocities.end());
+}
+
+template <int D, typename P>
+uint32_t flatTree<D, P>::accelerate(const vec<D>& pos, double mass, int index, double openingAngle, vec<D>& accel, double& potential) const {
+    if (nodes.empty()) return 0;
+
+    target t = {pos, {}, index, openingAngle * openingAngle, false, {}, {}, 0, 0};
+    _walk(0, rootPos, t);
+
+    unroll<D>::each([&] (int k) { accel[k] += (double) t.accel[k]; });
+    potential += mass * (double) t.potential;
+    return t.cost;
+}
+
+template <int D, typename P>
+uint32_t flatTree<D, P>::accelerate(const vec<D>& pos, const vec<D>& velocity, double mass, int index, double openingAngle,
+                                    vec<D>& accel, vec<D>& jerk, double& potential) const {
+    if (nodes.empty() || motions.size() != nodes.size()) return 0;
+
+    target t = {pos, velocity, index, openingAngle * openingAngle, true, {}, {}, 0, 0};
+    _walk(0, rootPos, t);
+
+    unroll<D>::each([&] (int k) {
+        accel[k] += (double) t.accel[k];
+        jerk[k] += (double) t.jerkSum[k];
+    });
+    potential += mass * (double) t.potential;
+    return t.cost;
+}
+
+// a = gm d / r^3, jerk = gm (u / r^3 - 3 (d.u) d / r^5) where d and u are the relative position and velocity
+template <typename T, int D>
+static void interact(const T* d, const T* u, T r2, T gm, bool jerk, T* accel, T* jerkSum, T& potential) {
+    T r = std::sqrt(r2);
+    T inv3 = gm / (r2 * r);
+
+    unroll<D>::each([&] (int k) { accel[k] = d[k] * inv3; });
+    potential = -gm / r;
+
+    if (!jerk) return;
+
+    T du = 0;
+    unroll<D>::each([&] (int k) { du += d[k] * u[k]; });
+    T s = 3 * du / r2;
+    unroll<D>::each([&] (int k) { jerkSum[k] = (u[k] - s * d[k]) * inv3; });
+}
+
+template <int D, typename P>
+void flatTree<D, P>::_walk(uint32_t i, const vec<D>& parentPos, target& t) const {
+    const node& n = nodes[i];
+    t.cost++;
+
+    vec<D> at, sep;
+    double r2 = 0;
+    unroll<D>::each([&] (int k) {
+        at[k] = parentPos[k] + (double) n.offset[k];
+        sep[k] = at[k] - t.pos[k];
+        if (period > 0) sep[k] -= period * std::round(sep[k] / period);
+        r2 += sep[k] * sep[k];
+    });
+
+    bool leaf = n.index >= 0;
+    if (leaf && (n.index == t.index || r2 == 0)) return;
+
+    // leaves are near field and evaluated in sum, nodes sufficiently far away are treated as singular in far
+    bool distant = !leaf && (double) n.size * n.size < t.theta2 * r2;
+    if (!leaf && !distant) {
+        for (uint32_t c = i + 1; c < n.next; c = nodes[c].next) _walk(c, at, t);
+        return;
+    }
+
+    t.cost++;
+    if (leaf) {
+        sum d[D], u[D] = {}, a[D], j[D], phi;
+        unroll<D>::each([&] (int k) {
+            d[k] = (sum) sep[k];
+            if (t.jerk) u[k] = (sum) ((double) motions[i].velocity[k] - t.velocity[k]);
+        });
+        interact<sum, D>(d, u, (sum) r2, (sum) (basicBody<D>::G * n.mass), t.jerk, a, j, phi);
+
+        unroll<D>::each([&] (int k) {
+            t.accel[k] += a[k];
+            if (t.jerk) t.jerkSum[k] += j[k];
+        });
+        t.potential += phi;
+    } else {
+        typedef typename P::far far;
+        far d[D], u[D] = {}, a[D], j[D], phi;
+        unroll<D>::each([&] (int k) {
+            d[k] = (far) sep[k];
+            if (t.jerk) u[k] = (far) ((double) motions[i].velocity[k] - t.velocity[k]);
+        });
+        interact<far, D>(d, u, (far) r2, (far) (basicBody<D>::G * n.mass), t.jerk, a, j, phi);
+
+        unroll<D>::each([&] (int k) {
+            t.accel[k] += (sum) a[k];
+            if (t.jerk) t.jerkSum[k] += (sum) j[k];
+        });
+        t.potential += (sum) phi;
+    }
+
+    if (ewald) {
+        double gm = basicBody<D>::G * (double) n.mass;
+        vec<D> a = {};
+        double phi = 0;
+        ewald->correct(sep, period, a, phi);
+
+        unroll<D>::each([&] (int k) { t.accel[k] += (sum) (gm * a[k]); });
+        t.potential += (sum) (gm * phi);
+    }
+}
+
+template class flatTree<2, doublePrecision>;
+template class flatTree<2, floatPrecision>;
+template class flatTree<2, mixedPrecision>;
+template class flatTree<3, doublePrecision>;
+template class flatTree<3, floatPrecision>;
+template class flatTree<3, mixedPrecision>;
@@ -0,0 +1,99 @@
+#ifndef FLATTREE_H
+#define FLATTREE_H
+
+#include <cstdint>
+#include <vector>
+#include "body.h"
+#include "precision.h"
+#include "ewald.h"
+
+// contiguous depth first copy of a built tree, only what the force walk reads, in the number types of P
+// masses and centres of mass are summed up from the leaves, so a tree whose bodies have moved since it was built
+// can be reused as is (the cells are only used to decide what to open)
+template <int D, typename P>
+class flatTree {
+private:
+    typedef typename P::storage storage;
+    typedef typename P::sum sum;
+
+    struct node {
+        storage offset[D]; // com relative to the parent's (reconstructed) com
+        storage mass;
+        float size; // cell width
+        int32_t index; // body index if this is a leaf, otherwise -1
+        uint32_t next; // first node after this subtree, children are the nodes between this and next
+    };
+
+    // com velocity of each node, only built when asked for
+    struct motion {
+        storage velocity[D];
+    };
+
+    // everything the walk needs to know about the body it is finding the force on
+    struct target {
+        vec<D> pos;
+        vec<D> velocity;
+        int index;
+        double theta2;
+        bool jerk;
+
+        sum accel[D];
+        sum jerkSum[D];
+        sum potential;
+
+        uint32_t cost; // nodes visited + interactions evaluated
+    };
+
+    std::vector<node> nodes;
+    std::vector<motion> motions;
+    vec<D> rootPos;
+
+    // width of the periodic box, 0 if the domain is not periodic
+    double period = 0;
+    const ewaldTable<D>* ewald = nullptr;
+
+    // build scratch, the nodes with their exact (double) com, velocity and parent
+    // subtrees near the root are flattened into their own buffer by separate tasks and appended in order afterwards
+    struct buffer {
+        std::vector<node> nodes;
+        std::vector<vec<D>> centres;
+        std::vector<vec<D>> velocities;
+        std::vector<uint32_t> parents;
+    };
+    buffer scratch;
+    static constexpr int SPAWN_DEPTH = 3; // nodes above this depth flatten their children as tasks
+
+    static void _flatten(basicBody<D>* b, uint32_t parent, double& mass, buffer& out, int depth);
+    static void _append(buffer& into, buffer& from, uint32_t parent);
+    void _walk(uint32_t i, const vec<D>& parentPos, target& t) const;
+public:
+    // velocities are needed for jerk
+    void build(basicBody<D>* root, bool velocities = false);
+    bool empty() const { return nodes.empty(); }
+
+    // every node is seen through its nearest periodic image and the table adds the pull of all other images
+    // the jerk only comes from the nearest image, size 0 goes back to an open domain
+    void setPeriodic(double size, const ewaldTable<D>* table) {
+        period = size;
+        ewald = (size > 0) ? table : nullptr;
+    }
+
+    // adds the acceleration on a body at pos to accel (the body itself, found by index, is skipped) and its potential energy to potential
+    // nodes seen at less than openingAngle (size / distance) are used as a single body
+    // returns how much work the walk was (nodes visited + interactions evaluated)
+    uint32_t accelerate(const vec<D>& pos, double mass, int index, double openingAngle, vec<D>& accel, double& potential) const;
+    // same as above and also adds da/dt to jerk, the tree must have been built with velocities
+    uint32_t accelerate(const vec<D>& pos, const vec<D>& velocity, double mass, int index, double openingAngle,
+                        vec<D>& accel, vec<D>& jerk, double& potential) const;
+};
+
+template <int D, typename P> constexpr int flatTree<D, P>::SPAWN_DEPTH;
+
+extern template class flatTree<2, doublePrecision>;
+extern template class flatTree<2, floatPrecision>;
+extern template class flatTree<2, mixedPrecision>;
+extern template class flatTree<3, doublePrecision>;
+extern template class flatTree<3, floatPrecision>;
+extern template class flatTree<3, mixedPrecision>;
+
+#endif
@@ -0,0 +1,179 @@
+#include <cmath>
+#include "integrator.h"
+
+// the passes below are kept as plain functions over restrict pointers so the compiler knows the arrays dont overlap and vectorises them
+// each one handles a single axis, the integrators run them once per dimension
+
+// leapfrog finite diff approx for t + 1
+static void leapfrogPass(double* __restrict x, double* __restrict v, double* __restrict a, const double* __restrict f,
+                         double dt, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        x[i] += v[i] * dt + 0.5 * a[i] * dt * dt;
+        v[i] += 0.5 * (f[i] + a[i]) * dt;
+        a[i] = f[i];
+    }
+}
+
+// half kick with a then a full drift of h
+static void kickDrift(double* __restrict x, double* __restrict v, const double* __restrict a, double h, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        v[i] += 0.5 * h * a[i];
+        x[i] += h * v[i];
+    }
+}
+
+// half kick with the new forces, which then become a
+static void kick(double* __restrict v, double* __restrict a, const double* __restrict f, double h, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        v[i] += 0.5 * h * f[i];
+        a[i] = f[i];
+    }
+}
+
+static void predict(double* __restrict x, double* __restrict v, const double* __restrict a, const double* __restrict j,
+                    double dt, size_t n) {
+    double dt2 = dt * dt / 2.0;
+    double dt3 = dt * dt * dt / 6.0;
+    for (size_t i = 0; i < n; i++) {
+        x[i] += v[i] * dt + a[i] * dt2 + j[i] * dt3;
+        v[i] += a[i] * dt + j[i] * dt2;
+    }
+}
+
+// x0, v0 are the state at the start of the step, a0 / j0 are replaced by a1 / j1
+static void correct(double* __restrict x, double* __restrict v, const double* __restrict x0, const double* __restrict v0,
+                    double* __restrict a0, double* __restrict j0, const double* __restrict a1, const double* __restrict j1,
+                    double dt, size_t begin, size_t end) {
+    double dt12 = dt * dt / 12.0;
+    for (size_t i = begin; i < end; i++) {
+        v[i] = v0[i] + 0.5 * (a0[i] + a1[i]) * dt + (j0[i] - j1[i]) * dt12;
+        x[i] = x0[i] + 0.5 * (v0[i] + v[i]) * dt + (a0[i] - a1[i]) * dt12;
+
+        a0[i] = a1[i];
+        j0[i] = j1[i];
+    }
+}
+
+template <int D>
+void basicLeapfrog<D>::advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) {
+    hooks.forces(false);
+    hooks.synchronised();
+
+    p.move([&p, dt] (size_t begin, size_t end) {
+        unroll<D>::each([&] (int k) { leapfrogPass(p.x[k].data(), p.v[k].data(), p.a[k].data(), p.f[k].data(), dt, begin, end); });
+    });
+}
+
+template <int D>
+bool basicForestRuth<D>::sameBodies(const std::vector<int>& next) {
+    if (next.size() != indices.size()) return false;
+
+    seen.assign(seen.size(), 0);
+    for (int index : indices) {
+        if ((size_t) index >= seen.size()) seen.resize((size_t) index * 2 + 1, 0);
+        seen[index] = 1;
+    }
+
+    for (int index : next) {
+        if ((size_t) index >= seen.size() || !seen[index]) return false;
+    }
+
+    return true;
+}
+
+template <int D>
+void basicForestRuth<D>::advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) {
+    static const double w1 = 1.0 / (2.0 - std::cbrt(2.0));
+    static const double w0 = -std::cbrt(2.0) * w1;
+    const double weights[3] = {w1, w0, w1};
+
+    // the first kick uses a, which is zero for new bodies and belongs to other positions after a switch from another
+    // integrator, same bodies in a new order (storage was reordered) still carry their own
+    // otherwise start again from the forces at the current positions
+    if (indices != p.index) {
+        if (!sameBodies(p.index)) {
+            hooks.forces(false);
+            for (int k = 0; k < D; k++) p.a[k] = p.f[k];
+        }
+        indices = p.index;
+    }
+
+    for (double w : weights) {
+        double h = w * dt;
+
+        p.move([&p, h] (size_t begin, size_t end) {
+            unroll<D>::each([&] (int k) { kickDrift(p.x[k].data(), p.v[k].data(), p.a[k].data(), h, begin, end); });
+        });
+
+        hooks.forces(false);
+
+        unroll<D>::each([&] (int k) { kick(p.v[k].data(), p.a[k].data(), p.f[k].data(), h, p.size()); });
+    }
+
+    hooks.synchronised();
+}
+
+template <int D>
+bool basicHermite<D>::remap(const std::vector<int>& next) {
+    if (next.size() != indices.size()) return false;
+
+    position.clear();
+    for (size_t i = 0; i < indices.size(); i++) {
+        if ((size_t) indices[i] >= position.size()) position.resize((size_t) indices[i] * 2 + 1, -1);
+        position[indices[i]] = (int) i;
+    }
+
+    // checked completely before anything is moved
+    for (int index : next) {
+        if ((size_t) index >= position.size() || position[index] < 0) return false;
+    }
+
+    for (std::vector<double>& axis : j) {
+        scratch.resize(next.size());
+        for (size_t i = 0; i < next.size(); i++) scratch[i] = axis[position[next[i]]];
+        axis.swap(scratch);
+    }
+
+    return true;
+}
+
+template <int D>
+void basicHermite<D>::advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) {
+    // same bodies in a new order (storage was reordered) keep their jerk
+    // otherwise a body was added or removed since the last step, start again from the current state
+    if (indices != p.index) {
+        if (!remap(p.index)) {
+            hooks.forces(true);
+            for (int k = 0; k < D; k++) {
+                p.a[k] = p.f[k];
+                j[k] = p.j[k];
+            }
+        }
+        indices = p.index;
+    }
+
+    for (int k = 0; k < D; k++) {
+        x0[k] = p.x[k];
+        v0[k] = p.v[k];
+    }
+
+    unroll<D>::each([&] (int k) { predict(p.x[k].data(), p.v[k].data(), p.a[k].data(), j[k].data(), dt, p.size()); });
+
+    hooks.forces(true);
+
+    p.move([this, &p, dt] (size_t begin, size_t end) {
+        unroll<D>::each([&] (int k) {
+            correct(p.x[k].data(), p.v[k].data(), x0[k].data(), v0[k].data(), p.a[k].data(), j[k].data(),
+                    p.f[k].data(), p.j[k].data(), dt, begin, end);
+        });
+    });
+
+    hooks.synchronised();
+}
+
+template class basicLeapfrog<2>;
+template class basicLeapfrog<3>;
+template class basicForestRuth<2>;
+template class basicForestRuth<3>;
+template class basicHermite<2>;
+template class basicHermite<3>;
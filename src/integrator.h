@@ -0,0 +1,93 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <vector>
+#include <functional>
+#include "particles.h"
+
+// what an integrator can ask of the simulation while advancing it
+struct integratorHooks {
+    // recomputes f and potential from the current positions (the tree is reused, not rebuilt), and j if jerk is set
+    std::function<void(bool jerk)> forces;
+    // called once per step at a point where positions, velocities and potentials all describe the same instant
+    std::function<void()> synchronised;
+};
+
+// moves bodies forward in time, the tree is only brought up to date with the new positions after advance returns
+// a holds the acceleration at the current positions from the end of the previous step (if there was one)
+// the last pass that changes positions must go through particles::move so the simulation knows which bodies left their cell
+template <int D>
+class basicIntegrator {
+public:
+    virtual ~basicIntegrator() {}
+
+    virtual const char* name() const = 0;
+    // force evaluations per step
+    virtual int stages() const = 0;
+    virtual void advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) = 0;
+    // forgets whatever was carried over from earlier steps, the next advance starts from the current state alone
+    virtual void reset() {}
+};
+
+// second order, one force evaluation per step
+template <int D>
+class basicLeapfrog : public basicIntegrator<D> {
+public:
+    const char* name() const override { return "Leapfrog"; }
+    int stages() const override { return 1; }
+    void advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) override;
+};
+
+// fourth order symplectic, three leapfrog steps of weights w1, w0, w1 (Yoshida 1990 / Forest and Ruth 1990)
+// the last force evaluation of a step is reused as the first of the next
+template <int D>
+class basicForestRuth : public basicIntegrator<D> {
+private:
+    // bodies (by index) advanced by the last step, only they carry an a from this integrator's last force evaluation
+    std::vector<int> indices;
+
+    // true if next holds the same bodies as indices, in any order
+    bool sameBodies(const std::vector<int>& next);
+    std::vector<char> seen; // sameBodies scratch, by body index
+public:
+    const char* name() const override { return "Forest-Ruth"; }
+    int stages() const override { return 3; }
+    void advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) override;
+    void reset() override { indices.clear(); }
+};
+
+// fourth order predictor corrector using acceleration and jerk, one force evaluation per step
+// not symplectic, but needs a quarter of the steps of leapfrog for the same error on smooth orbits
+template <int D>
+class basicHermite : public basicIntegrator<D> {
+private:
+    // jerk from the end of the last step, only valid while the same bodies (by index) are being advanced
+    std::vector<int> indices;
+    std::vector<double> j[D];
+
+    std::vector<double> x0[D], v0[D];
+
+    // puts j into the order of next if it holds the same bodies as indices, false if it doesnt
+    bool remap(const std::vector<int>& next);
+    std::vector<int> position; // remap scratch, where each body index was in indices
+    std::vector<double> scratch;
+public:
+    const char* name() const override { return "Hermite"; }
+    int stages() const override { return 1; }
+    void advance(basicParticles<D>& p, double dt, const integratorHooks& hooks) override;
+    void reset() override { indices.clear(); }
+};
+
+extern template class basicLeapfrog<2>;
+extern template class basicLeapfrog<3>;
+extern template class basicForestRuth<2>;
+extern template class basicForestRuth<3>;
+extern template class basicHermite<2>;
+extern template class basicHermite<3>;
+
+typedef basicIntegrator<2> integrator;
+typedef basicLeapfrog<2> leapfrog;
+typedef basicForestRuth<2> forestRuth;
+typedef basicHermite<2> hermite;
+
+#endif
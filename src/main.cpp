@@ -1,21 +1,138 @@
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
 #include "renderer.h"
 #include "universe.h"
+#include "trajectory.h"
+#include "exporter.h"
+#include "distributed.h"
 
 const int width = 800;
 const int height = 800;
 
-int main() {
-    Renderer& red = Renderer::getInstance();
-
-    if (!red.initialize(width, height)) return 1;
-
+Universe* createUniverse() {
     Universe* universe = new Universe(width, height, 400);
     universe->registerGalaxy({200, 200}, 3000, 10e6, {0, 0}, {1, 70});
     double r = 150;
     double v = std::sqrt(body::G * 10e6 / r);
     double a = 45.0 * 3.14159 / 180.0;
     universe->registerGalaxy({200 + r * std::cos(a), 200 - r * std::sin(a)}, 1000, 10e5, {-v * std::cos(a), -v * std::sin(a)}, {1, 40});
+    universe->publishFrame();
+
+    return universe;
+}
+
+// barnes-hut --headless [--steps n] [--every k] [--out prefix] [--ppm] [--density]
+// steps without a window and writes every kth frame to prefix000000.png, prefix000001.png, ...
+int runHeadless(int argc, char** argv) {
+    int steps = 1000;
+    int every = 10;
+    std::string prefix = "frame_";
+    frameExporter::format format = frameExporter::PNG;
+    snapshotConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--steps" && i + 1 < argc) steps = std::atoi(argv[++i]);
+        else if (arg == "--every" && i + 1 < argc) every = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--out" && i + 1 < argc) prefix = argv[++i];
+        else if (arg == "--ppm") format = frameExporter::PPM;
+        else if (arg == "--density") config.mode = rasterizer::DENSITY;
+    }
+
+    Universe* universe = createUniverse();
+    {
+        frameExporter exporter(prefix, format);
+        for (int i = 1; i <= steps; i++) {
+            universe->step();
+            if (i % every == 0) exporter.push(universe->snapshot(config), width, height);
+        }
+
+        // exporter finishes writing out queued frames before it goes out of scope
+    }
+
+    delete universe;
+    return 0;
+}
+
+#ifdef USE_MPI
+// mpirun -np 4 barnes-hut --distributed [--steps n] [--every k]
+// every rank steps its share of the bodies, rank 0 prints the global conserved quantities every kth step
+int runDistributed(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int steps = 1000;
+    int every = 10;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--steps" && i + 1 < argc) steps = std::atoi(argv[++i]);
+        else if (arg == "--every" && i + 1 < argc) every = std::max(1, std::atoi(argv[++i]));
+    }
+
+    // the initial state is only built on rank 0, the first decomposition spreads it out
+    Universe* universe = (rank == 0) ? createUniverse() : new Universe(width, height, 400);
+    universe->trackConserved = true;
+    {
+        distributedUniverse world(*universe);
+        for (int i = 1; i <= steps; i++) {
+            world.step();
+            if (i % every != 0) continue;
+
+            size_t count = world.count();
+            conservedQuantities c = world.conserved();
+            if (rank == 0) {
+                std::cout << "step " << i << " bodies " << count << " energy " << c.energy()
+                          << " momentum " << c.momentum.x << ", " << c.momentum.y << std::endl;
+            }
+        }
+    }
+
+    delete universe;
+    MPI_Finalize();
+    return 0;
+}
+#endif
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--headless") return runHeadless(argc, argv);
+#ifdef USE_MPI
+        if (std::string(argv[i]) == "--distributed") return runDistributed(argc, argv);
+#endif
+    }
+
+    Renderer& red = Renderer::getInstance();
+
+    if (!red.initialize(width, height)) return 1;
+
+    Universe* universe = createUniverse();
+    const camera home = universe->getCamera();
+
+    // simulation runs on its own thread as fast as it can, the ui only ever sees published frames
+    std::atomic<bool> alive(true), simRun(false), simStep(false), simRecord(false);
+    std::thread sim([&] () {
+        trajectoryWriter* trajectory = nullptr;
+        while (alive) {
+            // created and destroyed here so the writer is never deleted mid record
+            if (simRecord != (trajectory != nullptr)) {
+                delete trajectory;
+                trajectory = simRecord ? new trajectoryWriter("trajectory.bin", 10, true, true) : nullptr;
+            }
+
+            if (simRun || simStep.exchange(false)) {
+                universe->step();
+                if (trajectory) trajectory->record(*universe);
+            } else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        delete trajectory;
+    });
 
     GLuint imgTex;
     glGenTextures(1, &imgTex);
@@ -23,22 +140,101 @@ int main() {
     glBindTexture(GL_TEXTURE_2D, imgTex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are tightly packed rgb
+
+    bool uploaded = false;
+    uint64_t uploadedGeneration = 0;
 
     bool debug = false;
     bool drawQuadBounds = false;
     bool drawSameDepthOnly = false;
     bool run = false;
     int depth = -1;
+    double initialEnergy = 0;
+    bool record = false;
+    bool track = false;
+    bool density = false;
+    bool lod = false;
+    bool collide = false;
+    bool shrink = false;
+    bool periodic = false;
+    int scheme = 0;
     while (red.update()) {
-        if (run) universe->step();
-
         ImGui::Begin("Debug");
 
         ImGuiIO& io = ImGui::GetIO();
         ImGui::Text("FPS: %.1f", io.Framerate);
 
+        // scroll to zoom around the cursor, drag to pan
+        camera view = universe->getCamera();
+        if (!io.WantCaptureMouse && ImGui::IsMousePosValid()) {
+            if (io.MouseWheel != 0) {
+                point anchor = view.toWorld(io.MousePos.x, io.MousePos.y, width, height);
+                view.scale *= std::pow(0.8, io.MouseWheel);
+                view.centre = {anchor.x - (io.MousePos.x - width / 2.0) * view.scale,
+                               anchor.y - (io.MousePos.y - height / 2.0) * view.scale};
+            }
+
+            if (ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+                view.centre.x -= io.MouseDelta.x * view.scale;
+                view.centre.y -= io.MouseDelta.y * view.scale;
+            }
+        }
+        if (ImGui::Button("Reset View")) view = home;
+        ImGui::SameLine();
+        ImGui::Text("Zoom: %.2fx", home.scale / view.scale);
+
+        if (view != universe->getCamera()) {
+            universe->setCamera(view);
+            // a running simulation publishes with the new camera on its next step anyway
+            if (!run) universe->publishFrame();
+        }
+
         ImGui::Checkbox("Run", &run);
         ImGui::Checkbox("Debug", &debug);
+        ImGui::Checkbox("Density View", &density);
+        if (ImGui::Checkbox("Level of Detail", &lod)) {
+            universe->lodThreshold = lod ? 1.0 : 0.0;
+            universe->publishFrame();
+        }
+        simRun = run;
+
+        ImGui::Checkbox("Collisions", &collide);
+        universe->collisions = collide;
+        ImGui::Checkbox("Shrink Domain", &shrink);
+        universe->shrinkDomain = shrink;
+        ImGui::Checkbox("Periodic", &periodic);
+        universe->periodic = periodic;
+
+        int prevScheme = scheme;
+        ImGui::RadioButton("Leapfrog", &scheme, 0);
+        ImGui::SameLine();
+        ImGui::RadioButton("Forest-Ruth", &scheme, 1);
+        ImGui::SameLine();
+        ImGui::RadioButton("Hermite", &scheme, 2);
+        if (scheme != prevScheme) {
+            if (scheme == 0) universe->setIntegrator(std::unique_ptr<integrator>(new leapfrog()));
+            else if (scheme == 1) universe->setIntegrator(std::unique_ptr<integrator>(new forestRuth()));
+            else universe->setIntegrator(std::unique_ptr<integrator>(new hermite()));
+        }
+
+        ImGui::Checkbox("Record Trajectory", &record);
+        simRecord = record;
+
+        if (ImGui::Button("Save Checkpoint")) universe->saveCheckpoint("checkpoint.bin");
+        ImGui::SameLine();
+        if (ImGui::Button("Load Checkpoint")) universe->loadCheckpoint("checkpoint.bin");
+
+        if (ImGui::Checkbox("Track Conservation", &track)) initialEnergy = 0;
+        universe->trackConserved = track;
+        if (track) {
+            conservedQuantities c = universe->frame().conserved;
+            if (initialEnergy == 0) initialEnergy = c.energy();
+
+            ImGui::Text("Energy: %g (drift %.3e)", c.energy(), (initialEnergy == 0) ? 0 : (c.energy() - initialEnergy) / std::fabs(initialEnergy));
+            ImGui::Text("Momentum: (%g, %g)", c.momentum.x, c.momentum.y);
+            ImGui::Text("Angular Momentum: %g", c.angularMomentum);
+        }
 
         if (debug) {
             ImGui::Text("Depth: %i", depth);
@@ -70,7 +266,7 @@ int main() {
 
             if (ImGui::Button("Check Parent")) {
                 universe->traverse([] (body* b, int) -> bool {
-                    for (int i = 0; i < 4; i++) {
+                    for (int i = 0; i < body::CHILDREN; i++) {
                         if (b->children[i]) {
                             if (b->children[i]->parent != b) std::cout << "Fail" << std::endl;
                         }
@@ -82,20 +278,48 @@ int main() {
                 std::cout << "Finished Check" << std::endl;
             }
 
-            if (ImGui::Button("Step")) universe->step();
+            if (ImGui::Button("Validate Forces")) {
+                // sweep the opening angle to get the speed/accuracy tradeoff
+                std::vector<forceErrorReport> reports = universe->validateForces({0.1, 0.25, 0.5, 0.75, 1.0});
+                for (forceErrorReport& r : reports) {
+                    std::cout << "theta " << r.openingAngle
+                              << ": median " << r.median << ", p99 " << r.p99 << ", max " << r.max
+                              << " (tree " << r.treeMs << " ms, direct " << r.directMs << " ms)"
+                              << std::endl;
+                }
+                std::cout << std::endl;
+            }
+
+            if (ImGui::Button("Step")) simStep = true;
 
             if (ImGui::IsMousePosValid()) ImGui::Text("Mouse pos: (%g, %g)", io.MousePos.x, io.MousePos.y);
             else ImGui::Text("Mouse pos: <INVALID>");
         }
         ImGui::End();
 
-        snapshotConfig config = {debug, depth, drawQuadBounds, drawSameDepthOnly};
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, universe->snapshot(config));
+        snapshotConfig config = {debug, depth, drawQuadBounds, drawSameDepthOnly, density ? rasterizer::DENSITY : rasterizer::POINTS};
+        GLubyte* pixels = universe->snapshot(config);
+
+        // only upload what changed since the last frame we uploaded
+        uint64_t generation = universe->generation();
+        if (!uploaded || generation > uploadedGeneration + 1) {
+            // first upload, or more than one rewrite happened since the last one
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+            uploaded = true;
+        } else if (generation == uploadedGeneration + 1) {
+            dirtyRect d = universe->dirty();
+            // whole rows so the source stays contiguous
+            if (!d.empty()) glTexSubImage2D(GL_TEXTURE_2D, 0, 0, d.y0, width, d.y1 - d.y0, GL_RGB, GL_UNSIGNED_BYTE, pixels + 3 * (size_t) d.y0 * width);
+        }
+        uploadedGeneration = generation;
         ImGui::GetBackgroundDrawList()->AddImage((void*) imgTex, ImVec2(0, 0), ImVec2(width, height));
 
         red.render();
     }
 
+    alive = false;
+    sim.join();
+
     delete universe;
     red.cleanup();
     glDeleteTextures(1, &imgTex);
@@ -0,0 +1,53 @@
+#include "particles.h"
+
+template <int D>
+void basicParticles<D>::gather(const std::vector<basicBody<D>*>& bodies) {
+    size_t n = bodies.size();
+    for (int k = 0; k < D; k++) {
+        for (std::vector<double>* w : {&x[k], &v[k], &a[k], &f[k], &ll[k], &ur[k]}) w->resize(n);
+    }
+    potential.resize(n);
+    mass.resize(n);
+    index.resize(n);
+    moved.assign((n + 63) / 64, 0);
+
+    for (size_t i = 0; i < n; i++) {
+        basicBody<D>* b = bodies[i];
+        unroll<D>::each([&] (int k) {
+            x[k][i] = b->pos[k];
+            v[k][i] = b->velocity[k];
+            a[k][i] = b->accel.past[k];
+            f[k][i] = 0;
+
+            ll[k][i] = b->bounds.ll[k];
+            ur[k][i] = b->bounds.ur[k];
+        });
+        potential[i] = b->potential;
+        mass[i] = b->mass;
+        index[i] = b->index;
+    }
+}
+
+template <int D>
+void basicParticles<D>::scatter(const std::vector<basicBody<D>*>& bodies) const {
+    for (size_t i = 0; i < bodies.size(); i++) {
+        basicBody<D>* b = bodies[i];
+        unroll<D>::each([&] (int k) {
+            b->pos[k] = x[k][i];
+            b->velocity[k] = v[k][i];
+            b->accel.past[k] = a[k][i];
+            b->accel.future[k] = 0;
+        });
+        b->potential = potential[i];
+    }
+}
+
+template <int D>
+void basicParticles<D>::outside(const double* __restrict x, const double* __restrict ll, const double* __restrict ur, size_t count,
+                                uint64_t* __restrict out) {
+    // written as not inside so a nan, which compares false both ways, is flagged too
+    for (size_t i = 0; i < count; i++) out[i] |= (uint64_t) !((x[i] >= ll[i]) & (x[i] <= ur[i]));
+}
+
+template struct basicParticles<2>;
+template struct basicParticles<3>;
@@ -0,0 +1,75 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "body.h"
+
+// contiguous copy of the bodies being advanced by a step, so integration is plain loops over arrays (no pointer chasing)
+// that the compiler can vectorise, bodies are only touched again by gather and scatter
+// every per axis quantity is one array per dimension, x[k][i] is component k of the position of body i
+template <int D>
+struct basicParticles {
+    std::vector<double> x[D];
+    std::vector<double> v[D];
+    std::vector<double> a[D]; // acceleration at the current positions (accel.past)
+    std::vector<double> f[D]; // written by every force evaluation (accel.future)
+    std::vector<double> j[D]; // jerk, only written when a force evaluation asks for it
+    std::vector<double> potential;
+    std::vector<double> mass;
+    std::vector<int> index;
+
+    // bounds of the cell each body was in when gathered
+    std::vector<double> ll[D], ur[D];
+    // bit i is set when body i is outside its cell, written by move
+    std::vector<uint64_t> moved;
+
+    size_t size() const { return mass.size(); }
+
+    vec<D> position(size_t i) const {
+        vec<D> p;
+        unroll<D>::each([&] (int k) { p[k] = x[k][i]; });
+        return p;
+    }
+    vec<D> velocity(size_t i) const {
+        vec<D> u;
+        unroll<D>::each([&] (int k) { u[k] = v[k][i]; });
+        return u;
+    }
+
+    void gather(const std::vector<basicBody<D>*>& bodies);
+    // position, velocity and accel.past back onto the bodies (same order as gather), accel.future is cleared
+    void scatter(const std::vector<basicBody<D>*>& bodies) const;
+
+    // runs update(begin, end) over every body in blocks of 64, which may only change bodies in [begin, end)
+    // then records which of them ended up outside their cell while the block is still in cache
+    template <typename F>
+    void move(F update) {
+        size_t n = size();
+        moved.resize((n + 63) / 64);
+
+        for (size_t start = 0; start < n; start += 64) {
+            size_t end = std::min(n, start + 64);
+            update(start, end);
+
+            uint64_t out[64] = {};
+            unroll<D>::each([&] (int k) { outside(x[k].data() + start, ll[k].data() + start, ur[k].data() + start, end - start, out); });
+
+            uint64_t word = 0;
+            for (size_t i = 0; i < end - start; i++) word |= out[i] << i;
+            moved[start >> 6] = word;
+        }
+    }
+
+    // sets out[i] if x[i] is outside [ll[i], ur[i]] or nan, flags are kept unpacked so the comparisons vectorise
+    static void outside(const double* __restrict x, const double* __restrict ll, const double* __restrict ur, size_t count,
+                        uint64_t* __restrict out);
+};
+
+extern template struct basicParticles<2>;
+extern template struct basicParticles<3>;
+
+typedef basicParticles<2> particles;
+
+#endif
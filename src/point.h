@@ -1,17 +1,86 @@
 #ifndef POINT_H
 #define POINT_H
 
-struct point { double x, y; };
+// calls f(0) ... f(N - 1), expanded at compile time so per dimension / per child loops have no loop overhead
+template <int N>
+struct unroll {
+    template <typename F>
+    static void each(F&& f) {
+        unroll<N - 1>::each(f);
+        f(N - 1);
+    }
+};
+
+template <>
+struct unroll<0> {
+    template <typename F>
+    static void each(F&&) {}
+};
+
+// position in D dimensions, components are also reachable by index so code can be written once for every dimension
+template <int D>
+struct vec {
+    double c[D];
+    double& operator[](int i) { return c[i]; }
+    double operator[](int i) const { return c[i]; }
+};
+
+template <>
+struct vec<2> {
+    double x, y;
+    double& operator[](int i) { return (&x)[i]; }
+    double operator[](int i) const { return (&x)[i]; }
+};
+
+template <>
+struct vec<3> {
+    double x, y, z;
+    double& operator[](int i) { return (&x)[i]; }
+    double operator[](int i) const { return (&x)[i]; }
+};
+
+typedef vec<2> point;
 struct pointi { int x, y; };
 
-struct acceleration {
-    point past = {0, 0};
-    point future = {0, 0};
+template <int D>
+struct basicAcceleration {
+    vec<D> past = {};
+    vec<D> future = {};
 };
 
-struct quad {
-    point ll, ur;
-    bool contains(point p) { return p.x >= ll.x && p.y >= ll.y && p.x <= ur.x && p.y <= ur.y; }
+typedef basicAcceleration<2> acceleration;
+
+// axis aligned, ll holds the low corner and ur the high corner in every dimension
+template <int D>
+struct box {
+    vec<D> ll, ur;
+
+    bool contains(vec<D> p) const {
+        bool in = true;
+        unroll<D>::each([&] (int k) { in &= p[k] >= ll[k] && p[k] <= ur[k]; });
+        return in;
+    }
+    bool contains(box q) const {
+        bool in = true;
+        unroll<D>::each([&] (int k) { in &= q.ll[k] >= ll[k] && q.ur[k] <= ur[k]; });
+        return in;
+    }
+    bool intersects(box q) const {
+        bool hit = true;
+        unroll<D>::each([&] (int k) { hit &= q.ll[k] <= ur[k] && q.ur[k] >= ll[k]; });
+        return hit;
+    }
+    // 0 if p is inside
+    double distanceSquared(vec<D> p) const {
+        double d2 = 0;
+        unroll<D>::each([&] (int k) {
+            double d = (p[k] < ll[k]) ? ll[k] - p[k] : ((p[k] > ur[k]) ? p[k] - ur[k] : 0);
+            d2 += d * d;
+        });
+        return d2;
+    }
 };
 
+typedef box<2> quad;
+
 #endif
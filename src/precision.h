@@ -0,0 +1,30 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// number types used by the force calculation, chosen at compile time
+//  storage - what the flattened tree keeps node positions and masses in, positions are stored relative to the parent node
+//            so even float keeps ~7 significant digits of the node size rather than of the whole domain
+//  far - arithmetic for nodes that pass the opening test
+//  sum - accelerations are accumulated in this, leaf (near field) interactions are also evaluated in it
+// only the force walk follows the policy, the particle store the integrators advance (particles.h) is always double
+// positions there are absolute and get a small step added every step, which float would round away far from the origin
+struct doublePrecision {
+    typedef double storage;
+    typedef double far;
+    typedef double sum;
+};
+
+struct floatPrecision {
+    typedef float storage;
+    typedef float far;
+    typedef float sum;
+};
+
+// half the memory traffic of double, only the many cheap far field terms lose precision
+struct mixedPrecision {
+    typedef float storage;
+    typedef float far;
+    typedef double sum;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cstring>
+#include "raster.h"
+#include "scheduler.h"
+
+const rasterizer::stamp rasterizer::PIXEL = {1, {{0, 0}}, 0};
+const rasterizer::stamp rasterizer::CROSS = {5, {{0, 0}, {0, 1}, {0, -1}, {1, 0}, {-1, 0}}, 1};
+const rasterizer::stamp rasterizer::BLACK_HOLE = {8, {{0, 2}, {0, -2}, {2, 0}, {-2, 0}, {-1, 1}, {1, 1}, {-1, -1}, {1, -1}}, 2};
+
+rasterizer::lutEntry rasterizer::classify(double mass) {
+    static const unsigned char stellar[7][3] = {
+        {255, 181, 108},
+        {255, 218, 181},
+        {255, 237, 227},
+        {249, 245, 255},
+        {213, 224, 255},
+        {162, 192, 255},
+        {146, 181, 255}
+    };
+
+    auto entry = [] (const stamp* s, const unsigned char* c) -> lutEntry { return {s, {c[0], c[1], c[2]}}; };
+
+    // these dont match reality at all but /shrug
+    if (mass >= 10e3) return {&BLACK_HOLE, {255, 0, 0}};
+    else if (mass > 149.8) return entry(&CROSS, stellar[6]);
+    else if (mass > 149.5) return entry(&CROSS, stellar[5]);
+    else if (mass > 140) return entry(&PIXEL, stellar[4]);
+    else if (mass > 100) return entry(&PIXEL, stellar[3]);
+    else if (mass > 70) return entry(&PIXEL, stellar[2]);
+    else if (mass > 20) return entry(&PIXEL, stellar[1]);
+    else return entry(&PIXEL, stellar[0]);
+}
+
+rasterizer::rasterizer() {
+    // classify each bucket by its upper edge, thresholds are strict so every mass in the bucket lands on the same side
+    for (int k = 0; k < LUT_SIZE; k++) lut[k] = classify((k + 1) * LUT_STEP);
+    blackHole = classify(10e3);
+    cluster = classify(100);
+
+    // black -> red -> yellow -> white
+    for (int i = 0; i < 256; i++) {
+        double t = i / 255.0;
+        palette[i][0] = (unsigned char) (255 * std::min(1.0, 3 * t));
+        palette[i][1] = (unsigned char) (255 * std::min(1.0, std::max(0.0, 3 * t - 1)));
+        palette[i][2] = (unsigned char) (255 * std::min(1.0, std::max(0.0, 3 * t - 2)));
+    }
+}
+
+void rasterizer::parallel(int count, const std::function<void(int)>& foreach) {
+    scheduler::shared().parallelFor((size_t) count, 1, [&foreach] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) foreach((int) i);
+    });
+}
+
+void rasterizer::_bin(const std::vector<renderBody>& bodies, size_t start, size_t end, int thread,
+                      int width, int height, const camera& view) {
+    std::vector<std::vector<binned>>& local = bins[thread];
+    int bands = (int) local.size();
+
+    for (size_t i = start; i < end; i++) {
+        pointi c = view.toScreen(bodies[i].pos, width, height);
+        if (c.x < 0 || c.x >= width || c.y < 0 || c.y >= height) continue;
+
+        const lutEntry* look = lookup(bodies[i]);
+
+        // stamps near a band edge spill into the neighbouring band as well
+        int first = std::max(0, c.y - look->shape->reach) / BAND_HEIGHT;
+        int last = std::min(bands - 1, (c.y + look->shape->reach) / BAND_HEIGHT);
+        for (int band = first; band <= last; band++) local[band].push_back({c.x, c.y, (float) bodies[i].mass, look});
+    }
+}
+
+void rasterizer::_draw(unsigned char* window, int width, int height, int band) {
+    int y0 = band * BAND_HEIGHT;
+    int y1 = std::min(height, y0 + BAND_HEIGHT);
+
+    std::memset(window + 3 * (size_t) y0 * width, 0, 3 * (size_t) (y1 - y0) * width);
+
+    bandUsed[band] = 0;
+    for (std::vector<std::vector<binned>>& local : bins) bandUsed[band] |= !local[band].empty();
+
+    // threads binned contiguous slices in order, so walking them in order keeps the original draw order
+    for (std::vector<std::vector<binned>>& local : bins) {
+        for (binned& b : local[band]) {
+            const stamp* s = b.look->shape;
+            for (int i = 0; i < s->count; i++) {
+                int x = b.x + s->offsets[i].x;
+                int y = b.y + s->offsets[i].y;
+                if (x < 0 || x >= width || y < y0 || y >= y1) continue;
+
+                unsigned char* p = window + 3 * ((size_t) y * width + x);
+                p[0] = b.look->color[0];
+                p[1] = b.look->color[1];
+                p[2] = b.look->color[2];
+            }
+        }
+    }
+}
+
+void rasterizer::_accumulate(int width, int height, int band) {
+    int y0 = band * BAND_HEIGHT;
+    int y1 = std::min(height, y0 + BAND_HEIGHT);
+
+    float* rows = density.data() + (size_t) y0 * width;
+    std::fill(rows, rows + (size_t) (y1 - y0) * width, 0.0f);
+
+    // this thread owns the whole band so nothing here needs to be atomic
+    for (std::vector<std::vector<binned>>& local : bins) {
+        for (binned& b : local[band]) {
+            // bodies are only binned into neighbouring bands for their stamp, mass belongs to the centre pixel
+            if (b.y < y0 || b.y >= y1) continue;
+            rows[(size_t) (b.y - y0) * width + b.x] += b.mass;
+        }
+    }
+
+    float m = 0;
+    for (float* p = rows; p < rows + (size_t) (y1 - y0) * width; p++) m = std::max(m, *p);
+    bandMax[band] = m;
+    bandUsed[band] = m > 0;
+}
+
+void rasterizer::_toneMap(unsigned char* window, int width, int height, int band, float scale) {
+    int y0 = band * BAND_HEIGHT;
+    int y1 = std::min(height, y0 + BAND_HEIGHT);
+
+    const float* d = density.data() + (size_t) y0 * width;
+    unsigned char* p = window + 3 * (size_t) y0 * width;
+    for (size_t i = 0; i < (size_t) (y1 - y0) * width; i++, p += 3) {
+        int c = (int) (255.0f * std::log1p(d[i]) * scale);
+        const unsigned char* color = palette[std::min(255, c)];
+        p[0] = color[0];
+        p[1] = color[1];
+        p[2] = color[2];
+    }
+}
+
+void rasterizer::draw(const std::vector<renderBody>& bodies, unsigned char* window, int width, int height, const camera& view, mode m) {
+    int threads = (int) scheduler::shared().size();
+    int bands = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+    bandUsed.resize(bands);
+    bins.resize(threads);
+    for (std::vector<std::vector<binned>>& local : bins) {
+        local.resize(bands);
+        for (std::vector<binned>& bin : local) bin.clear();
+    }
+
+    size_t chunk = (bodies.size() + threads - 1) / threads;
+    parallel(threads, [&] (int t) {
+        size_t start = std::min(bodies.size(), t * chunk);
+        _bin(bodies, start, std::min(bodies.size(), start + chunk), t, width, height, view);
+    });
+
+    if (m == POINTS) {
+        parallel(bands, [&] (int band) { _draw(window, width, height, band); });
+        return;
+    }
+
+    density.resize((size_t) width * height);
+    bandMax.resize(bands);
+    parallel(bands, [&] (int band) { _accumulate(width, height, band); });
+
+    // log scaling, in solar masses so a lone star is still visible next to a black hole
+    float peak = *std::max_element(bandMax.begin(), bandMax.end());
+    float scale = (peak > 0) ? 1.0f / std::log1p(peak) : 0.0f;
+    parallel(bands, [&] (int band) { _toneMap(window, width, height, band, scale); });
+}
@@ -0,0 +1,120 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <vector>
+#include <cmath>
+#include <functional>
+#include "point.h"
+
+// maps world positions onto the screen, screen y points down
+struct camera {
+    point centre; // world position shown in the middle of the screen
+    double scale; // world length per pixel
+
+    pointi toScreen(point p, int width, int height) const {
+        return {(int) std::floor((p.x - centre.x) / scale + width / 2.0),
+                (int) std::floor((p.y - centre.y) / scale + height / 2.0)};
+    }
+
+    point toWorld(double x, double y, int width, int height) const {
+        return {centre.x + (x - width / 2.0) * scale, centre.y + (y - height / 2.0) * scale};
+    }
+
+    // world region covered by the screen, padded by margin pixels on every side
+    quad visible(int width, int height, double margin = 0) const {
+        return {toWorld(-margin, -margin, width, height), toWorld(width + margin, height + margin, width, height)};
+    }
+
+    bool operator==(camera c) const { return centre.x == c.centre.x && centre.y == c.centre.y && scale == c.scale; }
+    bool operator!=(camera c) const { return !(*this == c); }
+};
+
+struct renderBody {
+    point pos;
+    double mass;
+    bool aggregate; // stands in for a whole tree node (pos is its com)
+};
+
+// draws a whole frame of bodies in parallel, the screen is split into horizontal bands which are each owned by one thread
+class rasterizer {
+public:
+    enum mode {
+        POINTS, // individual stars coloured by mass
+        DENSITY // log scaled mass per pixel
+    };
+private:
+    // pixel offsets drawn around a body's position
+    struct stamp {
+        int count;
+        pointi offsets[8];
+        int reach; // furthest offset in y
+    };
+
+    struct lutEntry {
+        const stamp* shape;
+        unsigned char color[3];
+    };
+
+    struct binned {
+        int x, y;
+        float mass;
+        const lutEntry* look;
+    };
+
+    static constexpr double LUT_STEP = 0.1; // mass thresholds are all multiples of this
+    static constexpr double LUT_MAX = 150;
+    static constexpr int LUT_SIZE = (int) (LUT_MAX / LUT_STEP);
+    static constexpr int BAND_HEIGHT = 32;
+
+    static const stamp PIXEL, CROSS, BLACK_HOLE;
+
+    lutEntry lut[LUT_SIZE];
+    lutEntry blackHole;
+    lutEntry cluster; // aggregates have no meaningful per star mass, so they all look the same
+
+    // bins[thread][band], reused between frames
+    std::vector<std::vector<std::vector<binned>>> bins;
+
+    // whether anything non black was drawn into each band by the last draw
+    std::vector<char> bandUsed;
+
+    // DENSITY only, mass accumulated per pixel and the largest value in each band
+    std::vector<float> density;
+    std::vector<float> bandMax;
+    unsigned char palette[256][3];
+
+    const lutEntry* lookup(const renderBody& b) {
+        if (b.aggregate) return &cluster;
+
+        double mass = b.mass;
+        if (mass >= 10e3) return &blackHole;
+        // bucket k covers (k * step, (k + 1) * step]
+        int k = (int) std::ceil(mass / LUT_STEP) - 1;
+        return &lut[(k < 0) ? 0 : ((k >= LUT_SIZE) ? LUT_SIZE - 1 : k)];
+    }
+
+    static lutEntry classify(double mass);
+
+    void _bin(const std::vector<renderBody>& bodies, size_t start, size_t end, int thread,
+              int width, int height, const camera& view);
+    void _draw(unsigned char* window, int width, int height, int band);
+    void _accumulate(int width, int height, int band);
+    void _toneMap(unsigned char* window, int width, int height, int band, float scale);
+
+    // runs foreach(i) for every i in [0, count) on the shared scheduler
+    static void parallel(int count, const std::function<void(int)>& foreach);
+public:
+    rasterizer();
+
+    static constexpr int bandHeight() { return BAND_HEIGHT; }
+    // one entry per band of the last draw, non zero if the band has anything in it
+    const std::vector<char>& usedBands() { return bandUsed; }
+
+    // clears window then draws every body
+    void draw(const std::vector<renderBody>& bodies, unsigned char* window, int width, int height, const camera& view, mode m = POINTS);
+
+    rasterizer(rasterizer const&) = delete;
+    rasterizer& operator=(const rasterizer&) = delete;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include "scheduler.h"
+
+// set on pool threads only
+static thread_local const scheduler* currentPool = nullptr;
+static thread_local int currentQueue = -1;
+
+scheduler::scheduler(unsigned count) {
+    for (unsigned i = 0; i <= count; i++) queues.emplace_back(new queue());
+    for (unsigned i = 0; i < count; i++) workers.emplace_back(&scheduler::work, this, (int) i);
+}
+
+scheduler::~scheduler() {
+    {
+        std::lock_guard<std::mutex> l(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& w : workers) w.join();
+}
+
+scheduler& scheduler::shared() {
+    static scheduler pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+int scheduler::self() const {
+    return (currentPool == this) ? currentQueue : -1;
+}
+
+bool scheduler::take(int self, task& out) {
+    if (queued == 0) return false;
+
+    // own work first, newest
+    if (self >= 0) {
+        queue& q = *queues[self];
+        std::lock_guard<std::mutex> l(q.lock);
+        if (!q.tasks.empty()) {
+            out = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    // then steal the oldest from everyone else, starting after self so thieves spread out
+    int count = (int) queues.size();
+    for (int k = 1; k <= count; k++) {
+        int victim = (self + k + count) % count;
+        if (victim == self) continue;
+
+        queue& q = *queues[victim];
+        std::lock_guard<std::mutex> l(q.lock);
+        if (!q.tasks.empty()) {
+            out = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void scheduler::execute(task& t) {
+    t.run();
+    t.owner->pending--;
+}
+
+void scheduler::work(int index) {
+    currentPool = this;
+    currentQueue = index;
+
+    while (true) {
+        task t;
+        if (take(index, t)) {
+            execute(t);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(sleepLock);
+        wake.wait(l, [this] { return queued > 0 || stopping; });
+        if (stopping) return;
+    }
+}
+
+void scheduler::spawn(group& g, std::function<void()> f) {
+    g.pending++;
+
+    int own = self();
+    queue& q = *queues[(own >= 0) ? own : queues.size() - 1];
+    {
+        std::lock_guard<std::mutex> l(q.lock);
+        q.tasks.push_back({std::move(f), &g});
+    }
+    queued++;
+
+    // taking the lock orders this with a worker that is about to sleep, so the wake up cant be missed
+    { std::lock_guard<std::mutex> l(sleepLock); }
+    wake.notify_one();
+}
+
+void scheduler::wait(group& g) {
+    int own = self();
+    while (g.pending > 0) {
+        task t;
+        if (take(own, t)) execute(t);
+        else std::this_thread::yield(); // whatever is left is running on another thread
+    }
+}
+
+void scheduler::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& f) {
+    grain = std::max<size_t>(grain, 1);
+    group g;
+
+    std::function<void(size_t, size_t)> split = [&] (size_t begin, size_t end) {
+        while (end - begin > grain) {
+            size_t mid = begin + (end - begin) / 2;
+            spawn(g, [&split, mid, end] { split(mid, end); });
+            end = mid;
+        }
+        f(begin, end);
+    };
+
+    if (count > 0) split(0, count);
+    wait(g);
+}
@@ -0,0 +1,71 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// small work stealing pool, every worker owns a deque that it pushes to and pops from at the back (most recently
+// spawned, so a task that splits itself keeps working on the freshest and smallest piece) while idle workers steal
+// from the front of the others (the oldest and usually biggest pieces)
+// a thread waiting on a group runs queued tasks until the group is done, so tasks can spawn and wait on their own
+// subtasks and threads outside the pool (sim, ui) help out instead of blocking
+class scheduler {
+public:
+    // tasks spawned into a group that have not finished yet
+    struct group {
+        std::atomic<int> pending{0};
+    };
+private:
+    struct task {
+        std::function<void()> run;
+        group* owner;
+    };
+
+    struct queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    // one per worker, the last one is shared by every thread outside the pool
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<int> queued{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    // queue of the calling thread, -1 outside the pool
+    int self() const;
+    bool take(int self, task& out);
+    void execute(task& t);
+    void work(int index);
+public:
+    // workers besides whichever thread waits, so 0 still works by running everything on the waiting thread
+    explicit scheduler(unsigned workers);
+    ~scheduler();
+
+    // shared pool with one thread per core (the thread that waits counts as one)
+    static scheduler& shared();
+
+    // threads that can be working on tasks at once
+    unsigned size() const { return (unsigned) workers.size() + 1; }
+
+    void spawn(group& g, std::function<void()> f);
+    // runs queued tasks until everything spawned into g has finished
+    void wait(group& g);
+
+    // f(begin, end) over [0, count) in pieces of at most grain, split in halves so the first steals take the most work
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& f);
+
+    scheduler(scheduler const&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include "trajectory.h"
+#include "universe.h"
+
+constexpr char trajectoryHeader::MAGIC[8];
+
+// px, py, vx, vy
+static constexpr int CHANNELS = 4;
+
+static double channel(const strippedBody& b, int c) {
+    switch (c) {
+        case 0: return b.pos.x;
+        case 1: return b.pos.y;
+        case 2: return b.velocity.x;
+        default: return b.velocity.y;
+    }
+}
+
+static double& channel(trajectoryFrame& f, int c, size_t i) {
+    switch (c) {
+        case 0: return f.pos[i].x;
+        case 1: return f.pos[i].y;
+        case 2: return f.velocity[i].x;
+        default: return f.velocity[i].y;
+    }
+}
+
+template <typename T>
+static void append(std::vector<char>& buffer, T value) {
+    size_t s = buffer.size();
+    buffer.resize(s + sizeof(T));
+    std::memcpy(buffer.data() + s, &value, sizeof(T));
+}
+
+template <typename T>
+static T extract(const char*& p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+}
+
+trajectoryWriter::trajectoryWriter(const std::string& path, int every, bool quantize, bool delta, int keyframeInterval)
+    : out(path, std::ios::binary | std::ios::trunc) {
+    std::memcpy(header.magic, trajectoryHeader::MAGIC, sizeof(header.magic));
+    header.version = trajectoryHeader::VERSION;
+    header.flags = (quantize ? trajectoryHeader::QUANTIZE : 0) | (delta ? trajectoryHeader::DELTA : 0);
+    header.every = (uint32_t) std::max(1, every);
+    header.keyframeInterval = (uint32_t) std::max(1, keyframeInterval);
+
+    if (!out) {
+        std::cout << "WARN: Unable to open " << path << " for trajectory output." << std::endl;
+        return;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    worker = std::thread(&trajectoryWriter::_run, this);
+}
+
+trajectoryWriter::~trajectoryWriter() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+    signal.notify_one();
+
+    // worker drains whatever is still pending before exiting
+    if (worker.joinable()) worker.join();
+    if (dropped) std::cout << "WARN: Trajectory output dropped " << dropped << " frames." << std::endl;
+}
+
+void trajectoryWriter::record(Universe& universe) {
+    if (!worker.joinable()) return;
+    if (++steps % header.every != 0) return;
+
+    int target;
+    {
+        std::lock_guard<std::mutex> l(lock);
+        // both buffers are taken, never wait on the disk
+        if (pending != -1) {
+            dropped++;
+            return;
+        }
+
+        target = (busy == 0) ? 1 : 0;
+    }
+
+    // worker only touches pending/busy frames so this can be filled without the lock
+    universe.exportBodies(frames[target]);
+    frameStep[target] = steps;
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        pending = target;
+    }
+    signal.notify_one();
+}
+
+void trajectoryWriter::_run() {
+    while (true) {
+        int frame;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            signal.wait(l, [this] { return pending != -1 || stopping; });
+            if (pending == -1) return;
+
+            frame = busy = pending;
+            pending = -1;
+        }
+
+        _write(frames[frame], frameStep[frame]);
+
+        std::lock_guard<std::mutex> l(lock);
+        busy = -1;
+    }
+}
+
+void trajectoryWriter::_write(std::vector<strippedBody>& bodies, uint64_t step) {
+    bool quantize = header.flags & trajectoryHeader::QUANTIZE;
+    bool keyframe = !(header.flags & trajectoryHeader::DELTA) || sinceKeyframe == 0 || bodies.size() != previous.index.size();
+    for (size_t i = 0; !keyframe && i < bodies.size(); i++) keyframe = bodies[i].index != previous.index[i];
+
+    if (keyframe) {
+        sinceKeyframe = 0;
+        previous.index.resize(bodies.size());
+        previous.pos.assign(bodies.size(), {0, 0});
+        previous.velocity.assign(bodies.size(), {0, 0});
+        for (size_t i = 0; i < bodies.size(); i++) previous.index[i] = bodies[i].index;
+    }
+    previous.step = step;
+    sinceKeyframe = (sinceKeyframe + 1) % header.keyframeInterval;
+
+    payload.clear();
+    for (size_t i = 0; i < bodies.size(); i++) append<int32_t>(payload, bodies[i].index);
+
+    // deltas are taken against what the reader will reconstruct, not the true previous value, so error doesnt accumulate
+    for (int c = 0; c < CHANNELS; c++) {
+        for (size_t i = 0; i < bodies.size(); i++) {
+            double& recon = channel(previous, c, i);
+            double d = channel(bodies[i], c) - recon;
+
+            if (quantize) {
+                float f = (float) d;
+                append<float>(payload, f);
+                recon += (double) f;
+            } else {
+                append<double>(payload, d);
+                recon += d;
+            }
+        }
+    }
+
+    trajectoryChunk chunk = {step, (uint32_t) bodies.size(), keyframe ? trajectoryChunk::KEYFRAME : 0u, payload.size()};
+    out.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    out.write(payload.data(), (std::streamsize) payload.size());
+    out.flush();
+}
+
+trajectoryReader::trajectoryReader(const std::string& path) : in(path, std::ios::binary) {
+    if (!in) return;
+
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, trajectoryHeader::MAGIC, sizeof(header.magic)) != 0 || header.version != trajectoryHeader::VERSION) {
+        std::cout << "WARN: " << path << " is not a compatible trajectory." << std::endl;
+        in.setstate(std::ios::failbit);
+    }
+}
+
+bool trajectoryReader::next(trajectoryFrame& frame) {
+    trajectoryChunk chunk;
+    if (!in.read(reinterpret_cast<char*>(&chunk), sizeof(chunk))) return false;
+
+    payload.resize(chunk.payloadBytes);
+    if (!in.read(payload.data(), (std::streamsize) payload.size())) return false;
+
+    bool quantize = header.flags & trajectoryHeader::QUANTIZE;
+    size_t count = chunk.count;
+    if (payload.size() != count * (sizeof(int32_t) + CHANNELS * (quantize ? sizeof(float) : sizeof(double)))) return false;
+
+    if (chunk.flags & trajectoryChunk::KEYFRAME) {
+        previous.pos.assign(count, {0, 0});
+        previous.velocity.assign(count, {0, 0});
+    } else if (previous.pos.size() != count) {
+        return false;
+    }
+
+    const char* p = payload.data();
+    previous.step = chunk.step;
+    previous.index.resize(count);
+    for (size_t i = 0; i < count; i++) previous.index[i] = extract<int32_t>(p);
+
+    for (int c = 0; c < CHANNELS; c++) {
+        for (size_t i = 0; i < count; i++) {
+            double& recon = channel(previous, c, i);
+            recon += quantize ? (double) extract<float>(p) : extract<double>(p);
+        }
+    }
+
+    frame = previous;
+    return true;
+}
@@ -0,0 +1,111 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "body.h"
+#include "point.h"
+
+class Universe;
+
+/*
+* FILE LAYOUT
+* trajectoryHeader
+* (trajectoryChunk, payload) * frames
+*
+* payload is stored per channel: int32 index[count], then px, py, vx, vy each as count doubles (or floats if quantized)
+* delta frames store the difference to the previous reconstructed frame and always have the same indices as it
+*/
+
+struct trajectoryHeader {
+    static constexpr char MAGIC[8] = {'B', 'H', 'T', 'R', 'A', 'J', 0, 0};
+    static constexpr uint32_t VERSION = 1;
+
+    static constexpr uint32_t QUANTIZE = 1 << 0;
+    static constexpr uint32_t DELTA = 1 << 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t every; // steps between frames
+    uint32_t keyframeInterval;
+};
+
+struct trajectoryChunk {
+    static constexpr uint32_t KEYFRAME = 1 << 0;
+
+    uint64_t step;
+    uint32_t count;
+    uint32_t flags;
+    uint64_t payloadBytes;
+};
+
+struct trajectoryFrame {
+    uint64_t step = 0;
+    std::vector<int> index;
+    std::vector<point> pos;
+    std::vector<point> velocity;
+};
+
+// streams frames to disk from a background thread, the simulation only pays for copying the bodies
+class trajectoryWriter {
+private:
+    std::ofstream out;
+    trajectoryHeader header;
+
+    // double buffer, the simulation fills one while the worker writes the other
+    std::vector<strippedBody> frames[2];
+    uint64_t frameStep[2] = {0, 0};
+    int pending = -1; // frame waiting for the worker
+    int busy = -1; // frame currently being written
+    bool stopping = false;
+
+    std::mutex lock;
+    std::condition_variable signal;
+    std::thread worker;
+
+    // previous reconstructed frame, used for delta encoding (worker thread only)
+    trajectoryFrame previous;
+    uint32_t sinceKeyframe = 0;
+    std::vector<char> payload;
+
+    uint64_t steps = 0;
+
+    void _run();
+    void _write(std::vector<strippedBody>& bodies, uint64_t step);
+public:
+    uint64_t dropped = 0; // frames skipped because the disk fell behind
+
+    trajectoryWriter(const std::string& path, int every, bool quantize = false, bool delta = false, int keyframeInterval = 32);
+    ~trajectoryWriter();
+
+    bool valid() { return (bool) out; }
+
+    // call once per step, every header.every steps the current bodies are handed off to be written
+    void record(Universe& universe);
+
+    trajectoryWriter(trajectoryWriter const&) = delete;
+    trajectoryWriter& operator=(const trajectoryWriter&) = delete;
+};
+
+class trajectoryReader {
+private:
+    std::ifstream in;
+    std::vector<char> payload;
+    trajectoryFrame previous;
+public:
+    trajectoryHeader header = {};
+
+    trajectoryReader(const std::string& path);
+
+    bool valid() { return (bool) in; }
+    // reads and decodes the next frame, returns false once the stream is exhausted
+    bool next(trajectoryFrame& frame);
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "tree.h"
+
+template <int D>
+void tree<D>::insert(basicBody<D>* root, basicStrippedBody<D> star, const std::function<void(basicBody<D>*)>& placed) {
+    // https://stackoverflow.com/questions/8970500/visit-a-tree-or-graph-structure-using-tail-recursion
+    // in retrospect uneeded as the solution to stack size was preventing bodies from being too close to each other
+    // but something something sunk cost fallacy
+    std::queue<recursionState> states;
+    states.push({root, star, true});
+
+    while (!states.empty()) {
+        recursionState state = states.front();
+        states.pop(); // why doesnt it return the top :(
+
+        // a child always matches, but a node that was reparented when the domain grew can be a rounding error away from the
+        // bounds its siblings were split with, in which case fall back to picking the child by the midpoint
+        int match = -1;
+        for (int i = 0; match == -1 && i < basicBody<D>::CHILDREN; i++) {
+            if (state.node->getChild(i)->bounds.contains(state.star.pos)) match = i;
+        }
+        if (match == -1) {
+            match = 0;
+            unroll<D>::each([&] (int k) {
+                if (state.star.pos[k] > (state.node->bounds.ll[k] + state.node->bounds.ur[k]) / 2.0) match |= 1 << k;
+            });
+        }
+
+        basicBody<D>* child = state.node->getChild(match);
+        if (state.affectCoM) {
+            // edge case for root node, which starts with no mass
+            if (state.node->mass == 0) state.node->update(state.star);
+            else state.node->incrementCoM(state.star.pos, state.star.mass);
+        }
+
+        // child is empty, replace it with the star
+        // an internal node whose bodies have all left can keep a rounding residue of mass, with no index it is empty too
+        if (child->mass == 0 || (child->index == -1 && child->isLeaf())) {
+            child->update(state.star);
+            placed(child);
+        } else {
+            if (child->isLeaf()) {
+                // something is here and is leaf node -> therefore must be a singular body
+                // which means the child node then needs to become an internal node
+                // and have the new star and itself as children (not necessarily direct children)
+                states.push({child, child->strip(), false});
+                // remove this node from registeredBodies (to be readded in if statement above)
+                child->index = -1;
+            }
+            // dont need to reinit everything
+            state.node = child;
+            states.push(state);
+        }
+    }
+}
+
+template <int D>
+void tree<D>::traverse(basicBody<D>* node, const std::function<bool(basicBody<D>*, int)>& foreach, int _depth) {
+    if (!node || node->mass == 0) return;
+
+    // returning false means to end execution of current branch
+    if (!foreach(node, _depth)) return;
+
+    // directly access children as we dont want to evaluate any children (no operation is being performed here)
+    unroll<basicBody<D>::CHILDREN>::each([node, &foreach, _depth] (int i) { traverse(node->children[i], foreach, _depth + 1); });
+}
+
+template <int D>
+void tree<D>::traverseRange(basicBody<D>* node, box<D> range, const std::function<bool(basicBody<D>*, int)>& foreach, int _depth) {
+    if (!node || node->mass == 0 || !range.intersects(node->bounds)) return;
+
+    if (!foreach(node, _depth)) return;
+
+    unroll<basicBody<D>::CHILDREN>::each([node, &range, &foreach, _depth] (int i) { traverseRange(node->children[i], range, foreach, _depth + 1); });
+}
+
+template <int D>
+void tree<D>::destroy(basicBody<D>* node) {
+    unroll<basicBody<D>::CHILDREN>::each([node] (int i) {
+        if (node->children[i]) destroy(node->children[i]);
+    });
+
+    delete node;
+}
+
+template struct tree<2>;
+template struct tree<3>;
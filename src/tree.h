@@ -0,0 +1,32 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <queue>
+#include <functional>
+#include "body.h"
+
+// the tree algorithms, written once for every dimension (tree<2> is the quadtree Universe uses, tree<3> an octree)
+template <int D>
+struct tree {
+    struct recursionState {
+        basicBody<D>* node;
+        basicStrippedBody<D> star;
+        bool affectCoM;
+    };
+
+    // places star below root, placed is called with every node that ends up holding a star (including ones that get pushed down)
+    static void insert(basicBody<D>* root, basicStrippedBody<D> star, const std::function<void(basicBody<D>*)>& placed);
+
+    // foreach returns false to skip the children of a node, empty nodes are never visited
+    static void traverse(basicBody<D>* node, const std::function<bool(basicBody<D>*, int)>& foreach, int depth = 0);
+    // same as traverse but skips every node whose bounds do not intersect range
+    static void traverseRange(basicBody<D>* node, box<D> range, const std::function<bool(basicBody<D>*, int)>& foreach, int depth = 0);
+
+    // deletes node and everything below it
+    static void destroy(basicBody<D>* node);
+};
+
+extern template struct tree<2>;
+extern template struct tree<3>;
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// single producer single consumer handoff, neither side ever waits on the other
+// the producer always has a buffer to write into and the consumer always sees the newest complete one
+template <typename T>
+class tripleBuffer {
+private:
+    static constexpr int FRESH = 4; // set when middle holds something the consumer hasnt seen yet
+
+    T buffers[3];
+    int back = 0; // producer owned
+    int front = 1; // consumer owned
+    std::atomic<int> middle;
+public:
+    tripleBuffer() : middle(2) {}
+
+    // producer side
+    T& write() { return buffers[back]; }
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3; }
+
+    // consumer side, returns false (and keeps the current front) if nothing new was published
+    bool consume() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    T& read() { return buffers[front]; }
+
+    tripleBuffer(tripleBuffer const&) = delete;
+    tripleBuffer& operator=(const tripleBuffer&) = delete;
+};
+
+#endif
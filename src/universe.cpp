@@ -4,7 +4,14 @@
 #include <functional>
 #include <random>
 #include <queue>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include "Universe.h"
+#include "direct.h"
+#include "curve.h"
+#include "scheduler.h"
 
 void Universe::destroyStars(body* node) {
     if (!node) {
@@ -12,211 +19,593 @@ void Universe::destroyStars(body* node) {
         return;
     }
 
-    _destroyChild(node);
+    tree<2>::destroy(node);
 }
 
-void Universe::_destroyChild(body* parent) {
-    for (int i = 0; i < 4; i++) {
-        if (parent->children[i]) _destroyChild(parent->children[i]);
+void Universe::computeForces(const std::vector<body*>& bodies, particles& p, bool jerk, bool measure) {
+    // the flat tree is built from the leaves, so they need the current positions
+    for (size_t i = 0; i < bodies.size(); i++) {
+        bodies[i]->pos = p.position(i);
+        if (jerk) bodies[i]->velocity = p.velocity(i);
     }
 
-    delete parent;
-}
-
-void Universe::_registerStar(std::queue<recursionState>* states) {
-    // https://stackoverflow.com/questions/8970500/visit-a-tree-or-graph-structure-using-tail-recursion
-    // in retrospect uneeded as the solution to stack size was preventing bodies from being too close to each other
-    // but something something sunk cost fallacy
-    if (states->empty()) return;
-
-    recursionState state = states->front();
-    states->pop(); // why doesnt it return the top :(
+    forceTree.build(root, jerk);
+    if (periodic && ewald.empty()) ewald.build();
+    forceTree.setPeriodic(period(), &ewald);
+    if (jerk) {
+        p.j[0].assign(bodies.size(), 0);
+        p.j[1].assign(bodies.size(), 0);
+    }
 
-    for (int i = 0; i < 4; i++) {
-        body* child = state.node->getChild(i);
-        if (child->bounds.contains(state.star.pos)) {
-            if (state.affectCoM) {
-                // edge case for root node, which starts with no mass
-                if (state.node->mass == 0) state.node->update(state.star);
-                else state.node->incrementCoM(state.star.pos, state.star.mass);
+    if (bodyWork.size() < registeredBodies.size()) bodyWork.resize(registeredBodies.size(), 0);
+
+    // bodies are handed out to threads in runs along the hilbert curve, so each thread walks one compact part of the tree
+    // runs are sized by how much work each body has recently taken rather than by count, galaxy cores cost far more than disks
+    size_t n = bodies.size();
+    curveOrder.resize(n);
+    for (size_t i = 0; i < n; i++) curveOrder[i] = {hilbertKey(p.position(i), root->bounds), (uint32_t) i};
+    // storage is laid out in this order (see reorderStorage), so unless something moved across a key boundary there is nothing to do
+    if (!std::is_sorted(curveOrder.begin(), curveOrder.end())) std::sort(curveOrder.begin(), curveOrder.end());
+
+    // bodies that have not been measured yet count as the cheapest possible walk
+    auto weight = [this, &p] (uint32_t i) -> double { return std::max((double) bodyWork[p.index[i]], 1.0); };
+    workPrefix.resize(n + 1);
+    workPrefix[0] = 0;
+    for (size_t k = 0; k < n; k++) workPrefix[k + 1] = workPrefix[k] + weight(curveOrder[k].second);
+    double total = workPrefix[n];
+
+    auto range = [this, &p, jerk, measure] (size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            uint32_t i = curveOrder[k].second;
+            point pos = p.position(i);
+            point a = {0, 0};
+            double potential = 0;
+            uint32_t cost;
+
+            if (jerk) {
+                point j = {0, 0};
+                cost = forceTree.accelerate(pos, p.velocity(i), p.mass[i], p.index[i], openingAngle, a, j, potential);
+                p.j[0][i] = j.x;
+                p.j[1][i] = j.y;
+            } else {
+                cost = forceTree.accelerate(pos, p.mass[i], p.index[i], openingAngle, a, potential);
             }
 
-            // child is empty, replace it with the star
-            if (child->mass == 0) {
-                child->update(state.star);
-                registerToBodyIndex(child);
-            } else {
-                if (child->isLeaf()) {
-                    // something is here and is leaf node -> therefore must be a singular body
-                    // which means the child node then needs to become an internal node
-                    // and have the new star and itself as children (not necessarily direct children)
-                    states->push({child, child->strip(), false});
-                    // remove this node from registeredBodies (to be readded in if statement above)
-                    child->index = -1;
-                }
-                // dont need to reinit everything
-                state.node = child;
-                states->push(state);
+            for (const pointMass& m : external) {
+                double dx = m.pos.x - pos.x;
+                double dy = m.pos.y - pos.y;
+                double r2 = dx * dx + dy * dy;
+                if (r2 == 0) continue;
+
+                double r = std::sqrt(r2);
+                double gm = body::G * m.mass;
+                a.x += gm * dx / (r2 * r);
+                a.y += gm * dy / (r2 * r);
+                potential -= gm * p.mass[i] / r;
             }
 
-            break;
+            p.f[0][i] = a.x;
+            p.f[1][i] = a.y;
+            p.potential[i] = potential;
+            if (!measure) continue;
+
+            // only the walk, external masses cost the same for every body here so they say nothing about the body itself
+            // smoothed since what a walk costs also depends on how bodies were split last time
+            float& w = bodyWork[p.index[i]];
+            w = (w == 0) ? (float) cost : 0.5f * (w + (float) cost);
         }
+    };
+
+    scheduler& pool = scheduler::shared();
+    if (pool.size() == 1) {
+        range(0, n);
+        return;
     }
 
-    _registerStar(states);
+    // the bodies of a run of the curve that shares its top 2 * level key bits are exactly the bodies of one node at that
+    // depth of a tree over the root, so splitting on the next two bits hands out whole child subtrees
+    // dense subtrees keep splitting until their work is small enough and idle threads steal whatever is left
+    double grain = total / (16.0 * pool.size());
+    scheduler::group g;
+    std::function<void(size_t, size_t, int)> subtree = [&] (size_t begin, size_t end, int level) {
+        if (level == 32 || workPrefix[end] - workPrefix[begin] <= grain) {
+            range(begin, end);
+            return;
+        }
+
+        int shift = 62 - 2 * level;
+        for (size_t at = begin; at < end;) {
+            uint64_t cell = curveOrder[at].first >> shift;
+            size_t stop = std::partition_point(curveOrder.begin() + at, curveOrder.begin() + end,
+                [cell, shift] (const std::pair<uint64_t, uint32_t>& c) { return (c.first >> shift) == cell; }) - curveOrder.begin();
+
+            pool.spawn(g, [&subtree, at, stop, level] { subtree(at, stop, level + 1); });
+            at = stop;
+        }
+    };
+    subtree(0, n, 0);
+    pool.wait(g);
 }
 
 void Universe::step() {
+    std::lock_guard<std::mutex> guard(treeLock);
     if (registeredBodies.size() == 0) return;
 
-    for (int ind = 0; ind < bodyIndex; ind++) {
+    active.clear();
+    startPos.clear();
+    for (int ind : storage) {
         body* b = registeredBodies[ind];
         if (!b) continue;
 
-        // calc forces
-        _traverse(root, [this, b] (body* actor, int) -> bool {
-            if (actor->mass == 0 || actor == b) return false;
-
-            // if leaf node, manually calc force
-            if (actor->isLeaf()) {
-                b->applyForceFrom(actor);
-                return false;
-            } else {
-                double s = actor->bounds.ur.x - actor->bounds.ll.x;
-                double d = std::sqrt(
-                    (b->pos.x - actor->pos.x) * (b->pos.x - actor->pos.x) +
-                    (b->pos.y - actor->pos.y) * (b->pos.y - actor->pos.y));
+        active.push_back(b);
+        startPos.push_back(b->pos);
+    }
+    state.gather(active);
+
+    integratorHooks hooks;
+    hooks.forces = [this] (bool jerk) { computeForces(active, state, jerk, true); };
+    hooks.synchronised = [this] {
+        if (!trackConserved) return;
+
+        // state that matches the forces which were just calculated
+        conserved = {};
+        for (size_t i = 0; i < state.size(); i++) {
+            double m = state.mass[i];
+            double x = state.x[0][i], y = state.x[1][i], vx = state.v[0][i], vy = state.v[1][i];
+
+            conserved.kinetic += 0.5 * m * (vx * vx + vy * vy);
+            conserved.potential += 0.5 * state.potential[i];
+            conserved.momentum.x += m * vx;
+            conserved.momentum.y += m * vy;
+            conserved.angularMomentum += m * (x * vy - y * vx);
+        }
+    };
+
+    integrate->advance(state, timeStep, hooks);
+    if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval) reorderStorage();
+    if (periodic) {
+        // anything that wrapped is outside its cell and already flagged as moved
+        for (size_t i = 0; i < state.size(); i++) {
+            point p = wrap(state.position(i));
+            state.x[0][i] = p.x;
+            state.x[1][i] = p.y;
+        }
+    }
+    state.scatter(active);
 
-                double delta = s / d;
+    // bring every com up to date first, so removals and bodies pushed down by reinsertion below all see the new positions
+    for (size_t i = 0; i < active.size(); i++) {
+        body* b = active[i];
 
-                // node is sufficiently far away, treat as singular
-                if (delta < body::DELTA) {
-                    b->applyForceFrom(actor, d);
-                    return false;
+        // a position that is no longer finite can never be placed, remove it as the ancestors still know it (at its
+        // start position) so the nan never reaches their com
+        if (!std::isfinite(b->pos.x) || !std::isfinite(b->pos.y)) {
+            registeredBodies[b->index] = nullptr;
+            for (int k = 0; k < body::CHILDREN; k++) {
+                if (b->parent->children[k] == b) {
+                    b->parent->children[k] = nullptr;
+                    break;
                 }
             }
 
-            return true;
-        });
+            b->parent->notifyChildRemoval(startPos[i], b->mass, [] (body* parent) -> bool {return parent == nullptr; });
+
+            delete b;
+            active[i] = nullptr;
+            treeGeneration++;
+            continue;
+        }
+
+        // TODO maybe some variation of s/d can be used here to determine if the movement is large enough to affect parent CoM?
+        point delta = {b->pos.x - startPos[i].x, b->pos.y - startPos[i].y};
+        b->parent->notifyChildMovement(delta, b->mass, [] (body* parent) -> bool {return parent == nullptr;});
+    }
+
+    // every body that left its cell is taken out before any are put back, a body can only be pushed down the tree
+    // by a reinsertion if it is still inside its cell
+    // only bodies flagged by the integrator can have left their cell
+    leavers.clear();
+    for (size_t w = 0; w < state.moved.size(); w++) {
+        uint64_t bits = state.moved[w];
+        for (int j = 0; bits; j++, bits >>= 1) {
+            if (!(bits & 1)) continue;
+            body* b = active[w * 64 + j];
+            if (!b) continue; // removed above
+
+            // star moved out of current quad bounds (possibly out of the root too, registerStar grows it to fit)
+            // TODO all bodies are leaf nodes which do not have children
+            // therefore these bodies can easily be removed and reintroduced
+            // it would be fastest to search for position to insert into upwards but that functionality
+            // is not currently supported
+            leavers.push_back(_removeStar(b));
+        }
+    }
+
+    for (const strippedBody& sb : leavers) registerStar(sb);
+
+    if (collisions) resolveCollisions();
+    if (shrinkDomain && !periodic) shrinkRoot();
+
+    _publishFrame();
+}
+
+void Universe::registerStar(strippedBody sb) {
+    if (!std::isfinite(sb.pos.x) || !std::isfinite(sb.pos.y)) {
+        std::cout << "WARN: Star " << sb.index << " has no finite position and was not registered." << std::endl;
+        return;
+    }
+
+    treeGeneration++;
+    if (periodic) sb.pos = wrap(sb.pos);
+    while (!root->bounds.contains(sb.pos)) growRoot(sb.pos);
+    tree<2>::insert(root, sb, [this] (body* b) { registerToBodyIndex(b); });
+}
+
+void Universe::growRoot(point toward) {
+    // the old root becomes one child of a root twice its size, extended along every axis towards the given point
+    quad old = root->bounds;
+    quad grown = old;
+    int ind = 0;
+    for (int k = 0; k < 2; k++) {
+        double extent = old.ur[k] - old.ll[k];
+        if (toward[k] < old.ll[k]) {
+            grown.ll[k] = old.ll[k] - extent;
+            ind |= 1 << k;
+        } else grown.ur[k] = old.ur[k] + extent;
+    }
+
+    body* next = new body{root->pos, grown, root->mass, {nullptr}};
+    next->children[ind] = root;
+    root->parent = next;
+    root = next;
+    treeGeneration++;
+}
+
+void Universe::shrinkRoot() {
+    // while only one child holds anything it can take over as root, a single body is never made the root though
+    while (true) {
+        body* only = nullptr;
+        int used = 0;
+        for (int i = 0; i < body::CHILDREN; i++) {
+            if (root->children[i] && root->children[i]->mass > 0) {
+                only = root->children[i];
+                used++;
+            }
+        }
+        if (used != 1 || only->isLeaf()) return;
+
+        for (int i = 0; i < body::CHILDREN; i++) {
+            if (root->children[i] != only && root->children[i]) tree<2>::destroy(root->children[i]);
+            root->children[i] = nullptr;
+        }
+        delete root;
+        root = only;
+        root->parent = nullptr;
+        treeGeneration++;
+    }
+}
+
+void Universe::reorderStorage() {
+    // the last force evaluation of this step already sorted every body being advanced along the curve, and those are
+    // exactly the live bodies in storage (nothing is added or removed until advance returns)
+    if (curveOrder.size() != state.size()) return;
+
+    for (int ind : storage) slotOf[ind] = -1;
+    storage.clear();
+    for (const std::pair<uint64_t, uint32_t>& c : curveOrder) {
+        int ind = state.index[c.second];
+        slotOf[ind] = (int) storage.size();
+        storage.push_back(ind);
+    }
+    stepsSinceReorder = 0;
+}
+
+void Universe::setIntegrator(std::unique_ptr<integrator> i) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    integrate = std::move(i);
+}
+
+strippedBody Universe::_removeStar(body* b) {
+    strippedBody sb = b->strip();
+
+    // remove self from parents CoM as well
+    b->parent->notifyChildRemoval(b->pos, b->mass, [] (body* parent) -> bool {return parent == nullptr;});
+    registeredBodies[b->index] = nullptr;
+    b->mass = 0; // mass 0 denotes that this is not a star, irrespective of pos/vel/accel
+    b->index = -1;
+    treeGeneration++;
+
+    return sb;
+}
+
+void Universe::resolveCollisions() {
+    double maxRadius = 0;
+    for (int ind = 0; ind < bodyIndex; ind++) {
+        if (registeredBodies[ind]) maxRadius = std::max(maxRadius, collisionRadius(registeredBodies[ind]->mass));
     }
+    if (maxRadius == 0) return;
+    double size = period();
+
+    // detection only reads the tree, so the pool searches around the bodies of a slice of the body index per task
+    // slices are small enough that threads done with the outskirts can steal from the dense cores
+    // a pair is only kept by its lower index so it is found exactly once
+    scheduler& pool = scheduler::shared();
+    int chunk = std::max(64, bodyIndex / (int) (16 * pool.size()));
+    size_t chunks = (size_t) ((bodyIndex + chunk - 1) / chunk);
+    std::vector<std::vector<std::pair<int, int>>> found(chunks);
+
+    pool.parallelFor(chunks, 1, [this, chunk, maxRadius, size, &found] (size_t first, size_t last) {
+        for (size_t c = first; c < last; c++) {
+            int end = std::min(bodyIndex, (int) (c + 1) * chunk);
+            for (int ind = (int) c * chunk; ind < end; ind++) {
+                body* b = registeredBodies[ind];
+                if (!b) continue;
+
+                double r = collisionRadius(b->mass);
+                _queryRadius(b->pos, r + maxRadius, [this, b, r, c, size, &found] (body* other) {
+                    if (other->index <= b->index) return;
+
+                    double reach = r + collisionRadius(other->mass);
+                    point d = separation(b->pos, other->pos, size);
+                    if (d.x * d.x + d.y * d.y < reach * reach) found[c].push_back({b->index, other->index});
+                });
+            }
+        }
+    });
+
+    std::vector<std::pair<int, int>> pairs;
+    for (auto& f : found) pairs.insert(pairs.end(), f.begin(), f.end());
+    if (pairs.empty()) return;
+
+    // resolve in index order so the result doesnt depend on how the work was split
+    std::sort(pairs.begin(), pairs.end());
+
+    for (auto& p : pairs) {
+        body* a = registeredBodies[p.first];
+        body* b = registeredBodies[p.second];
+        // already merged into something else this step
+        if (!a || !b) continue;
+
+        // the heavier body survives and keeps its index, perfectly inelastic so momentum is conserved
+        if (b->mass > a->mass) std::swap(a, b);
+        strippedBody sa = _removeStar(a);
+        strippedBody sb = _removeStar(b);
+
+        double m = sa.mass + sb.mass;
+        strippedBody merged = sa;
+        merged.mass = m;
+        // measured from sa so a pair touching across the edge of a periodic box merges between them (registerStar wraps it)
+        point d = separation(sa.pos, sb.pos, size);
+        merged.pos = {sa.pos.x + d.x * sb.mass / m, sa.pos.y + d.y * sb.mass / m};
+        merged.velocity = {(sa.velocity.x * sa.mass + sb.velocity.x * sb.mass) / m, (sa.velocity.y * sa.mass + sb.velocity.y * sb.mass) / m};
+        merged.accel.past = {(sa.accel.past.x * sa.mass + sb.accel.past.x * sb.mass) / m, (sa.accel.past.y * sa.mass + sb.accel.past.y * sb.mass) / m};
+
+        registerStar(merged);
+    }
+}
 
-    // apply the acceleration (and velocity)
+std::vector<forceErrorReport> Universe::validateForces(const std::vector<double>& angles) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    std::vector<forceErrorReport> reports;
+
+    std::vector<body*> bodies;
+    std::vector<point> pos;
+    std::vector<double> mass;
     for (int ind = 0; ind < bodyIndex; ind++) {
         body* b = registeredBodies[ind];
         if (!b) continue;
 
-        point prev = b->pos;
-        hideBody(b);
+        bodies.push_back(b);
+        pos.push_back(b->pos);
+        mass.push_back(b->mass);
+    }
 
-        // leapfrog finite diff approx for t + 1
-        double dt = 0.0025; // if inner ring starts pulsating in and out, decrease t
-        b->pos.x += b->velocity.x * dt + 0.5 * b->accel.past.x * dt * dt;
-        b->pos.y += b->velocity.y * dt + 0.5 * b->accel.past.y * dt * dt;
+    if (bodies.empty()) return reports;
 
-        b->velocity.x += 0.5 * (b->accel.future.x + b->accel.past.x) * dt;
-        b->velocity.y += 0.5 * (b->accel.future.y + b->accel.past.y) * dt;
+    // a periodic domain is checked against the direct sum over nearest images and the same ewald correction
+    double size = period();
+    if (size > 0 && ewald.empty()) ewald.build();
 
-        b->accel.past = b->accel.future;
-        b->accel.future = {0, 0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<point> exact;
+    directForces(pos, mass, exact, size, (size > 0) ? &ewald : nullptr);
+    double directMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-        // out of bounds, remove
-        if (!(root->bounds.contains(b->pos))) {
-            registeredBodies[b->index] = nullptr;
-            for (int i = 0; i < 4; i++) {
-                if (b->parent->children[i] == b) {
-                    b->parent->children[i] = nullptr;
-                    break;
-                }
-            }
+    // forces are written into the copy and the walks are not measured, so the bodies and the work estimates the next
+    // step balances by are left as they were
+    particles copy;
+    copy.gather(bodies);
 
-            // remove influence of this node on parent
-            b->parent->notifyChildRemoval(b->pos, b->mass, [] (body* parent) -> bool {return parent == nullptr; });
+    // only the bodies in this universe are in the direct sum, so masses from other ranks are left out of the tree forces too
+    std::vector<pointMass> prevExternal;
+    prevExternal.swap(external);
 
-            delete b;
-            continue;
-        }
+    double prevAngle = openingAngle;
+    std::vector<double> err(bodies.size());
+    for (double angle : angles) {
+        openingAngle = angle;
 
-        drawBody(b);
+        start = std::chrono::steady_clock::now();
+        computeForces(bodies, copy, false, false);
+        double treeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-        // if star moves out of current quad bounds
-        if (!b->bounds.contains(b->pos)) {
-            // TODO all bodies are leaf nodes which do not have children
-            // therefore these bodies can easily be removed and reintroduced
-            // it would be fastest to search for position to insert into upwards but that functionality
-            // is not currently supported
-            strippedBody sb = b->strip();
+        for (size_t i = 0; i < bodies.size(); i++) {
+            point a = {copy.f[0][i], copy.f[1][i]};
+            double dx = a.x - exact[i].x;
+            double dy = a.y - exact[i].y;
+            double mag = std::sqrt(exact[i].x * exact[i].x + exact[i].y * exact[i].y);
 
-            // remove self from parents CoM as well
-            b->parent->notifyChildRemoval(b->pos, b->mass, [] (body* parent) -> bool {return parent == nullptr;});
-            registeredBodies[b->index] = nullptr;
-            b->mass = 0; // mass 0 denotes that this is not a star, irrespective of pos/vel/accel
-            b->index = -1;
-
-            registerStar(sb);
-        } else {
-            // TODO maybe some variation of s/d can be used here to determine if the movement is large enough to affect parent CoM?
-            point delta = {b->pos.x - prev.x, b->pos.y - prev.y};
-            b->parent->notifyChildMovement(delta, b->mass, [] (body* parent) -> bool {return parent == nullptr;});
+            err[i] = (mag == 0) ? 0 : std::sqrt(dx * dx + dy * dy) / mag;
         }
+
+        // everything past mid is >= median after the first partial sort, so the second only needs that section
+        size_t n = err.size();
+        size_t mid = n / 2, top = std::min(n - 1, (size_t) (0.99 * (n - 1) + 0.5));
+        std::nth_element(err.begin(), err.begin() + mid, err.end());
+        double median = err[mid];
+        std::nth_element(err.begin() + mid, err.begin() + top, err.end());
+        double p99 = err[top];
+        double max = *std::max_element(err.begin() + top, err.end());
+
+        reports.push_back({angle, median, p99, max, treeMs, directMs});
     }
+
+    openingAngle = prevAngle;
+    external.swap(prevExternal);
+
+    return reports;
 }
 
 void Universe::resizeWindow(int w, int h, bool redraw) {
-    if (renderWindow) delete[] renderWindow;
+    // buffers are kept for as long as the size doesnt change
+    if (!renderWindow || w != width || h != height) {
+        if (renderWindow) delete[] renderWindow;
+
+        this->width = w;
+        this->height = h;
 
-    this->width = w;
-    this->height = h;
+        renderWindow = new GLubyte[(int) (width * height * 3)] {0};
 
-    renderWindow = new GLubyte[(int) (width * height * 3)] {0};
+        // debug layers are allocated on first use
+        base.clear();
+        overlay.clear();
+        prevBands.clear();
+
+        markDirty({0, 0, width, height});
+    }
 
     if (redraw) {
-        for (int i = 0; i < bodyIndex; i++) {
-            if (!registeredBodies[i]) continue;
-            drawBody(registeredBodies[i]);
+        drawFrame(renderWindow);
+        markDirty({0, 0, width, height});
+        prevBands = raster.usedBands();
+    }
+}
+
+void Universe::_publishFrame() {
+    renderFrame& f = frames.write();
+    f.bodies.clear();
+
+    {
+        std::lock_guard<std::mutex> guard(viewLock);
+        f.view = view;
+    }
+
+    // one pixel of slack for rounding at the screen edge
+    quad visible = f.view.visible(width, height, 1);
+    double lod = lodThreshold * f.view.scale;
+
+    if (lod > 0) {
+        // cost scales with the number of visible nodes that are at least lod wide rather than with the number of bodies
+        _traverseRange(root, visible, [&f, lod] (body* b, int) -> bool {
+            bool leaf = b->isLeaf();
+            if (!leaf && b->bounds.ur.x - b->bounds.ll.x >= lod) return true;
+
+            f.bodies.push_back({b->pos, b->mass, !leaf});
+            return false;
+        });
+    } else if (!visible.contains(root->bounds)) {
+        _traverseRange(root, visible, [&f, &visible] (body* b, int) -> bool {
+            if (!b->isLeaf()) return true;
+
+            if (visible.contains(b->pos)) f.bodies.push_back({b->pos, b->mass, false});
+            return false;
+        });
+    } else {
+        // everything is on screen, the flat list is cheaper than walking the tree
+        for (int ind = 0; ind < bodyIndex; ind++) {
+            body* b = registeredBodies[ind];
+            if (b) f.bodies.push_back({b->pos, b->mass, false});
         }
     }
+
+    f.conserved = trackConserved ? conserved : conservedQuantities();
+
+    frames.publish();
+}
+
+void Universe::drawFrame(GLubyte* target) {
+    const renderFrame& f = frames.read();
+    raster.draw(f.bodies, target, width, height, f.view, prevConfig.mode);
 }
 
 GLubyte* & Universe::snapshot(snapshotConfig config) {
-    // config changes, redraw everything
-    // unoptimized but should be fine since this is just for debugging and should not be changing without user input
-    if (config != prevConfig) resizeWindow(width, height);
-    else if (config.debug) resizeWindow(width, height, false);
+    bool fresh = frames.consume();
+    bool changed = config != prevConfig;
     prevConfig = config;
 
-    // normal drawing is handled by step
-    if (config.debug) {
-        _traverse(root, [this, config] (body* b, int depth) -> bool {
-            pointi _p = toRenderGridCoords(b->pos);
+    if (!config.debug) {
+        if (!fresh && !changed) return renderWindow;
 
-            // quad bound drawing
-            if (config.showQuad && (config.depth == -1 || config.depth == depth)) {
-                GLubyte* outline = (b->mass == 0) ? red : green;
+        drawFrame(renderWindow);
 
-                pointi ll = toRenderGridCoords(b->bounds.ll);
-                pointi ur = toRenderGridCoords(b->bounds.ur);
+        const std::vector<char>& bands = raster.usedBands();
+        if (changed || bands.size() != prevBands.size()) markDirty({0, 0, width, height});
+        else {
+            // only bands that have something now or had something before can differ
+            int first = -1, last = -1;
+            for (int i = 0; i < (int) bands.size(); i++) {
+                if (!bands[i] && !prevBands[i]) continue;
+                if (first == -1) first = i;
+                last = i;
+            }
 
-                for (int x = ll.x; x < ur.x; x++) {
-                    drawPixel(3 * (ll.y * width + x), outline);
-                    drawPixel(3 * (ur.y * width + x), outline);
-                }
+            int h = rasterizer::bandHeight();
+            if (first == -1) markDirty({0, 0, 0, 0});
+            else markDirty({0, first * h, width, std::min(height, (last + 1) * h)});
+        }
+        prevBands = bands;
 
-                for (int y = ll.y; y < ur.y; y++) {
-                    drawPixel(3 * (y * width + ll.x), outline);
-                    drawPixel(3 * (y * width + ur.x), outline);
-                }
-            }
+        return renderWindow;
+    }
 
-            if (b->mass == 0) return true;
+    // the tree only changes alongside a new frame, so if neither moved the last composite is still correct
+    if (!fresh && !changed) return renderWindow;
 
-            // draw point
-            GLubyte* color = (b->isLeaf()) ? green : red;
-            if (!config.drawSameDepthOnly || (config.depth == -1 || config.depth == depth)) drawSquare(b->pos, 10, color);
+    size_t pixels = (size_t) width * height;
+    if (base.size() != 3 * pixels) base.assign(3 * pixels, 0);
+    if (overlay.size() != 4 * pixels) overlay.assign(4 * pixels, 0);
+    else std::memset(overlay.data(), 0, overlay.size());
 
-            return true;
-        });
+    drawFrame(base.data());
+
+    {
+        // blocks until the current step finishes, the nodes are only collected again when the tree changed
+        // since the last debug frame but every step moves the com markers
+        std::lock_guard<std::mutex> guard(treeLock);
+        if (depthIndexGeneration != treeGeneration) buildDepthIndex();
+        else refreshDepthIndex();
+    }
+
+    for (int depth = 0; depth < (int) depthIndex.size(); depth++) {
+        bool matching = config.depth == -1 || config.depth == depth;
+
+        // quad bound drawing
+        if (config.showQuad && matching) {
+            for (nodeInfo& n : depthIndex[depth]) drawOutline(n.bounds, green);
+        }
     }
 
+    for (int depth = 0; depth < (int) depthIndex.size(); depth++) {
+        bool matching = config.depth == -1 || config.depth == depth;
+        if (config.drawSameDepthOnly && !matching) continue;
+
+        // draw point
+        for (nodeInfo& n : depthIndex[depth]) drawSquare(n.pos, 10, n.leaf ? green : red);
+    }
+
+    // overlay pixels with alpha set replace the bodies underneath
+    const GLubyte* o = overlay.data();
+    const GLubyte* b = base.data();
+    GLubyte* out = renderWindow;
+    for (size_t i = 0; i < pixels; i++, o += 4, b += 3, out += 3) {
+        const GLubyte* src = o[3] ? o : b;
+        out[0] = src[0];
+        out[1] = src[1];
+        out[2] = src[2];
+    }
+
+    markDirty({0, 0, width, height});
+
     return renderWindow;
 }
 
@@ -262,36 +651,309 @@ void Universe::registerGalaxy(point center, int amt, double coreMass, point core
     }
 }
 
-void Universe::_traverse(body* node, const std::function<bool(body*, int)>& foreach, int _depth) {
-    if (!node || node->mass == 0) return;
+void Universe::_queryRange(quad range, const std::function<void(body*)>& foreach) {
+    auto inside = [this, &foreach] (quad piece) {
+        _traverseRange(root, piece, [&piece, &foreach] (body* b, int) -> bool {
+            if (!b->isLeaf()) return true;
+
+            // index -1 is an internal node whose children have all left
+            if (b->index >= 0 && piece.contains(b->pos)) foreach(b);
+            return false;
+        });
+    };
+
+    double size = period();
+    if (size == 0) {
+        inside(range);
+        return;
+    }
+
+    // along every axis the range is moved to start inside the root, whatever sticks out past the far edge is the same
+    // as that much at the near edge. a range at least as wide as the box covers the whole axis
+    quad pieces[2][2];
+    int count[2];
+    for (int k = 0; k < 2; k++) {
+        double ll = root->bounds.ll[k], ur = root->bounds.ur[k];
+        double shift = size * std::floor((range.ll[k] - ll) / size);
+        double lo = range.ll[k] - shift, hi = range.ur[k] - shift;
+
+        count[k] = 1;
+        if (range.ur[k] - range.ll[k] >= size) {
+            lo = ll;
+            hi = ur;
+        } else if (hi > ur) {
+            pieces[k][1].ll[k] = ll;
+            pieces[k][1].ur[k] = hi - size;
+            hi = ur;
+            count[k] = 2;
+        }
+        pieces[k][0].ll[k] = lo;
+        pieces[k][0].ur[k] = hi;
+    }
+
+    for (int i = 0; i < count[0]; i++) {
+        for (int j = 0; j < count[1]; j++) inside({{pieces[0][i].ll.x, pieces[1][j].ll.y}, {pieces[0][i].ur.x, pieces[1][j].ur.y}});
+    }
+}
+
+void Universe::_queryRadius(point p, double r, const std::function<void(body*)>& foreach) {
+    double r2 = r * r;
+    double size = period();
+    _traverse(root, [&p, r2, size, &foreach] (body* b, int) -> bool {
+        if (distanceSquared(b->bounds, p, size) > r2) return false;
+        if (!b->isLeaf()) return true;
+        if (b->index < 0) return false;
+
+        point d = separation(p, b->pos, size);
+        if (d.x * d.x + d.y * d.y <= r2) foreach(b);
+        return false;
+    });
+}
+
+std::vector<int> Universe::queryRange(quad range) {
+    std::lock_guard<std::mutex> guard(treeLock);
 
-    // returning false means to end execution of current branch
-    if (!foreach(node, _depth)) return;
+    std::vector<int> found;
+    _queryRange(range, [&found] (body* b) { found.push_back(b->index); });
+    return found;
+}
+
+std::vector<int> Universe::queryRadius(point p, double r) {
+    std::lock_guard<std::mutex> guard(treeLock);
 
-    // directly access children as we dont want to evaluate any children (no operation is being performed here)
-    _traverse(node->children[0], foreach, _depth + 1);
-    _traverse(node->children[1], foreach, _depth + 1);
-    _traverse(node->children[2], foreach, _depth + 1);
-    _traverse(node->children[3], foreach, _depth + 1);
+    std::vector<int> found;
+    _queryRadius(p, r, [&found] (body* b) { found.push_back(b->index); });
+    return found;
 }
 
-bool Universe::drawPixel(point p, GLubyte* c) {
-    int ind = toRenderGrid(p);
-    if (ind < 0 || ind >= width * height * 3) return false;
+std::vector<int> Universe::queryNearest(point p, int k) {
+    std::lock_guard<std::mutex> guard(treeLock);
 
-    renderWindow[ind] = c[0];
-    renderWindow[ind + 1] = c[1];
-    renderWindow[ind + 2] = c[2];
+    std::vector<int> found;
+    if (k <= 0 || root->mass == 0) return found;
 
-    return true;
+    // best first: always expand the node closest to p, stop once it is further than the kth best body
+    typedef std::pair<double, body*> entry;
+    std::priority_queue<entry, std::vector<entry>, std::greater<entry>> open;
+    std::priority_queue<entry> best; // max heap of the k closest so far
+    double size = period();
+
+    open.push({distanceSquared(root->bounds, p, size), root});
+    while (!open.empty()) {
+        entry e = open.top();
+        open.pop();
+
+        if ((int) best.size() == k && e.first > best.top().first) break;
+
+        body* b = e.second;
+        if (b->isLeaf()) {
+            if (b->index < 0) continue;
+
+            point d = separation(p, b->pos, size);
+            best.push({d.x * d.x + d.y * d.y, b});
+            if ((int) best.size() > k) best.pop();
+            continue;
+        }
+
+        for (int i = 0; i < body::CHILDREN; i++) {
+            body* c = b->children[i];
+            if (c && c->mass != 0) open.push({distanceSquared(c->bounds, p, size), c});
+        }
+    }
+
+    found.resize(best.size());
+    for (int i = (int) best.size() - 1; i >= 0; i--) {
+        found[i] = best.top().second->index;
+        best.pop();
+    }
+
+    return found;
+}
+
+void Universe::exportBodies(std::vector<strippedBody>& out) {
+    quad bounds;
+    int nextIndex;
+    exportBodies(out, bounds, nextIndex);
+}
+
+void Universe::exportBodies(std::vector<strippedBody>& out, quad& bounds, int& nextIndex) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    out.clear();
+    for (int ind = 0; ind < bodyIndex; ind++) {
+        body* b = registeredBodies[ind];
+        if (b) out.push_back(b->strip());
+    }
+
+    // the root is replaced whenever the domain grows or shrinks
+    bounds = root->bounds;
+    nextIndex = bodyIndex;
+}
+
+std::vector<strippedBody> Universe::releaseStars(const std::function<bool(const strippedBody&)>& leave) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    std::vector<strippedBody> released;
+    for (int ind = 0; ind < bodyIndex; ind++) {
+        body* b = registeredBodies[ind];
+        if (b && leave(b->strip())) released.push_back(_removeStar(b));
+    }
+
+    return released;
+}
+
+void Universe::adoptStars(const std::vector<strippedBody>& stars, const std::vector<float>& work) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    for (size_t i = 0; i < stars.size(); i++) {
+        const strippedBody& sb = stars[i];
+        bodyIndex = std::max(bodyIndex, sb.index + 1);
+        registerStar(sb);
+
+        if (i < work.size()) {
+            if ((size_t) sb.index >= bodyWork.size()) bodyWork.resize((size_t) sb.index * 2 + 1, 0);
+            bodyWork[sb.index] = work[i];
+        }
+    }
+}
+
+double Universe::work(int index) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    return (index >= 0 && (size_t) index < bodyWork.size()) ? bodyWork[index] : 0;
+}
+
+void Universe::essentialNodes(quad region, std::vector<pointMass>& out) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    double theta2 = openingAngle * openingAngle;
+    _traverse(root, [&] (body* b, int) -> bool {
+        if (b->isLeaf()) {
+            if (b->index >= 0) out.push_back({b->pos, b->mass});
+            return false;
+        }
+
+        // same test as the force walk, against the closest any body in region can get
+        double size = b->bounds.ur.x - b->bounds.ll.x;
+        if (size * size < theta2 * region.distanceSquared(b->pos)) {
+            out.push_back({b->pos, b->mass});
+            return false;
+        }
+
+        return true;
+    });
 }
 
-bool Universe::drawPixel(int ind, GLubyte* c) {
-    if (ind >= (width * height * 3) || ind < 0) return false;
+void Universe::setExternalMasses(std::vector<pointMass> masses) {
+    std::lock_guard<std::mutex> guard(treeLock);
+    external = std::move(masses);
+}
+
+void Universe::saveCheckpoint(const std::string& path) {
+    std::vector<strippedBody> bodies;
+    quad bounds;
+    int nextIndex;
+    exportBodies(bodies, bounds, nextIndex);
+
+    checkpointHeader header = {};
+    std::memcpy(header.magic, checkpointHeader::MAGIC, sizeof(header.magic));
+    header.version = checkpointHeader::VERSION;
+    header.recordSize = sizeof(strippedBody);
+    header.count = bodies.size();
+    header.bodyIndex = nextIndex;
+    header.bounds = bounds;
+
+    checkpoints.write(path, header, std::move(bodies));
+}
+
+bool Universe::loadCheckpoint(const std::string& path) {
+    // may be restoring the checkpoint that is still being written
+    checkpoints.wait();
 
-    renderWindow[ind] = c[0];
-    renderWindow[ind + 1] = c[1];
-    renderWindow[ind + 2] = c[2];
+    mappedFile file(path);
+    if (!file.valid() || file.size() < sizeof(checkpointHeader)) {
+        std::cout << "WARN: Unable to read checkpoint " << path << std::endl;
+        return false;
+    }
+
+    const checkpointHeader* header = static_cast<const checkpointHeader*>(file.get());
+    if (std::memcmp(header->magic, checkpointHeader::MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != checkpointHeader::VERSION || header->recordSize != sizeof(strippedBody)) {
+        std::cout << "WARN: " << path << " is not a compatible checkpoint (version " << header->version << ")" << std::endl;
+        return false;
+    }
 
+    if (file.size() < sizeof(checkpointHeader) + header->count * sizeof(strippedBody)) {
+        std::cout << "WARN: Checkpoint " << path << " is truncated." << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(treeLock);
+    destroyStars(root);
+    root = new body{{0, 0}, header->bounds, 0, {nullptr}};
+    treeGeneration++;
+
+    bodyIndex = (int) header->bodyIndex;
+    registeredBodies.assign(std::max(bodyIndex, 100), nullptr);
+    storage.clear();
+    slotOf.assign(registeredBodies.size(), -1);
+    stepsSinceReorder = 0;
+    // neither the jerk or substep state of the integrator nor the measured walk costs belong to the restored bodies,
+    // even where their indices are the same
+    integrate->reset();
+    bodyWork.clear();
+
+    // records are used directly from the mapping
+    const strippedBody* bodies = reinterpret_cast<const strippedBody*>(header + 1);
+    for (uint64_t i = 0; i < header->count; i++) registerStar(bodies[i]);
+
+    _publishFrame();
     return true;
 }
+
+void Universe::buildDepthIndex() {
+    for (std::vector<nodeInfo>& nodes : depthIndex) nodes.clear();
+
+    _traverse(root, [this] (body* b, int depth) -> bool {
+        if (depth >= (int) depthIndex.size()) depthIndex.resize(depth + 1);
+        depthIndex[depth].push_back({b, b->bounds, b->pos, b->isLeaf()});
+        return true;
+    });
+
+    // drop depths that no longer exist
+    while (!depthIndex.empty() && depthIndex.back().empty()) depthIndex.pop_back();
+    depthIndexGeneration = treeGeneration;
+}
+
+void Universe::refreshDepthIndex() {
+    for (std::vector<nodeInfo>& nodes : depthIndex) {
+        for (nodeInfo& n : nodes) n.pos = n.node->pos;
+    }
+}
+
+void Universe::drawSpan(int y, int x0, int x1, GLubyte* c) {
+    if (y < 0 || y >= height) return;
+
+    x0 = std::max(x0, 0);
+    x1 = std::min(x1, width - 1);
+    if (x0 > x1) return;
+
+    GLubyte* o = &overlay[4 * ((size_t) y * width + x0)];
+    for (int x = x0; x <= x1; x++, o += 4) {
+        o[0] = c[0];
+        o[1] = c[1];
+        o[2] = c[2];
+        o[3] = 255;
+    }
+}
+
+void Universe::drawColumn(int x, int y0, int y1, GLubyte* c) {
+    if (x < 0 || x >= width) return;
+
+    y0 = std::max(y0, 0);
+    y1 = std::min(y1, height - 1);
+    if (y0 > y1) return;
+
+    GLubyte* o = &overlay[4 * ((size_t) y0 * width + x)];
+    for (int y = y0; y <= y1; y++, o += 4 * width) {
+        o[0] = c[0];
+        o[1] = c[1];
+        o[2] = c[2];
+        o[3] = 255;
+    }
+}
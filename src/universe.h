@@ -6,10 +6,25 @@
 #include <cmath>
 #include <ctime>
 #include <queue>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
-#include "renderer.h"
 #include "body.h"
+#include "tree.h"
+#include "flattree.h"
+#include "integrator.h"
 #include "point.h"
+#include "checkpoint.h"
+#include "triplebuffer.h"
+#include "raster.h"
+
+// number types of the force walk, see precision.h
+typedef doublePrecision forcePrecision;
+
+// same as the gl typedef, universe does not need a window or gl context so it avoids pulling in renderer.h
+typedef unsigned char GLubyte;
 
 /*
 * UNITS
@@ -23,123 +38,243 @@ struct snapshotConfig {
     int depth = -1;
     bool showQuad = false;
     bool drawSameDepthOnly = false;
+    rasterizer::mode mode = rasterizer::POINTS;
 
-    bool operator==(snapshotConfig con) { return std::memcmp(this, &con, sizeof(snapshotConfig)) == 0; }
+    // field by field, memcmp would also compare (uninitialized) padding
+    bool operator==(snapshotConfig con) {
+        return debug == con.debug && depth == con.depth && showQuad == con.showQuad &&
+               drawSameDepthOnly == con.drawSameDepthOnly && mode == con.mode;
+    }
     bool operator!=(snapshotConfig con) { return !(*this == con); }
 };
 
-struct recursionState {
-    body* node;
-    strippedBody star;
-    bool affectCoM;
+// relative error of the tree accelerations against direct summation
+struct forceErrorReport {
+    double openingAngle;
+    double median, p99, max;
+    double treeMs, directMs;
+};
+
+// totals over all bodies at the positions forces were last calculated for
+struct conservedQuantities {
+    double kinetic = 0;
+    double potential = 0;
+    point momentum = {0, 0};
+    double angularMomentum = 0; // about the origin
+
+    double energy() const { return kinetic + potential; }
+};
+
+// immutable copy of the simulation state handed from step() to the renderer
+struct renderFrame {
+    std::vector<renderBody> bodies;
+    conservedQuantities conserved;
+    camera view; // bodies outside of this were culled
+};
+
+// region of renderWindow that changed, x1 and y1 are exclusive
+struct dirtyRect {
+    int x0, y0, x1, y1;
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+};
+
+// what the debug overlay needs to know about a node
+struct nodeInfo {
+    const body* node; // only valid until treeGeneration moves
+    quad bounds;
+    point pos; // copied from node under treeLock, the com moves every step even if the tree doesnt
+    bool leaf;
+};
+
+// a body or a whole tree node seen from far enough away to be treated as one
+struct pointMass {
+    point pos;
+    double mass;
 };
 
 class Universe {
 private:
     int width, height;
-    double lengthPerPixel;
     snapshotConfig prevConfig;
 
+    // written by the ui thread, read under viewLock by _publishFrame
+    camera view;
+    std::mutex viewLock;
+
     GLubyte black[3] = { 0, 0, 0 };
     GLubyte white[3] = { 255, 255, 255 };
     GLubyte red[3] = {255, 0, 0};
     GLubyte green[3] = {0, 255, 0};
     GLubyte orange[3] = {255, 165, 0};
 
-    GLubyte stellar[7][3] = {
-        {255, 181, 108},
-        {255, 218, 181},
-        {255, 237, 227},
-        {249, 245, 255},
-        {213, 224, 255},
-        {162, 192, 255},
-        {146, 181, 255}
-    };
-
     body* root = nullptr;
     std::vector<body*> registeredBodies;
     int bodyIndex = 0;
 
-    void destroyStars(body* root);
-    void _destroyChild(body* parent);
+    checkpointWriter checkpoints;
+
+    // held by step() and anything else that touches the tree, the renderer only takes it when drawing debug info
+    std::mutex treeLock;
+    tripleBuffer<renderFrame> frames;
+    rasterizer raster;
+    void _publishFrame();
+    void drawFrame(GLubyte* target);
+
+    // debug mode only, bodies are drawn into base and the tree into overlay (rgba, alpha marks drawn pixels)
+    // then both are composited into renderWindow
+    std::vector<GLubyte> base;
+    std::vector<GLubyte> overlay;
+
+    // bumped every time renderWindow is rewritten, lastDirty covers what that rewrite changed
+    uint64_t frameGeneration = 0;
+    dirtyRect lastDirty = {0, 0, 0, 0};
+    std::vector<char> prevBands; // raster bands that had content before the last rewrite
+    void markDirty(dirtyRect d) {
+        frameGeneration++;
+        lastDirty = d;
+    }
 
-    void _registerStar(std::queue<recursionState>* states);
+    // bumped whenever a body is inserted into or removed from the tree or a node is created or deleted (under treeLock)
+    uint64_t treeGeneration = 0;
+    // debug only, every non empty node grouped by depth, rebuilt lazily when treeGeneration moves
+    std::vector<std::vector<nodeInfo>> depthIndex;
+    uint64_t depthIndexGeneration = ~0ull;
+    void buildDepthIndex();
+    // copies the current com of every cached node, needs treeLock and an index that matches treeGeneration
+    void refreshDepthIndex();
 
-    void _traverse(body* node, const std::function<bool(body*, int)>& foreach, int depth = 0);
+    void destroyStars(body* root);
 
-    // TODO move into seperate file
-    // draw pixel with color, assuming color is a pointer to GLubyte array of at least size 3
-    bool drawPixel(point p, GLubyte* color);
-    bool drawPixel(int ind, GLubyte* color);
-    void drawSquare(point p, int r, GLubyte* color) {
-        int x = (int) (p.x / lengthPerPixel);
-        int y = (int) (p.y / lengthPerPixel);
-        int hr = r / 2;
+    void _traverse(body* node, const std::function<bool(body*, int)>& foreach, int depth = 0) { tree<2>::traverse(node, foreach, depth); }
+    // same as _traverse but skips every node whose bounds do not intersect range
+    void _traverseRange(body* node, quad range, const std::function<bool(body*, int)>& foreach, int depth = 0) {
+        tree<2>::traverseRange(node, range, foreach, depth);
+    }
 
-        for (int _x = -hr; _x < hr; _x++) {
-            for (int _y = -hr; _y < hr; _y++) {
-                drawPixel(3 * ((y + _y) * width + x + _x), color);
-            }
+    // copy of the tree in the number types of forcePrecision, rebuilt by every computeForces
+    flatTree<2, forcePrecision> forceTree;
+    // built the first time the domain is made periodic
+    ewaldTable<2> ewald;
+    // sets f and potential (and j if jerk) of p from its positions, bodies are the tree nodes p was gathered from
+    // measure records what each walk cost in bodyWork, off for evaluations that are not part of a step
+    void computeForces(const std::vector<body*>& bodies, particles& p, bool jerk, bool measure);
+
+    // pulls on every body in addition to the tree, see setExternalMasses
+    std::vector<pointMass> external;
+
+    // tree work (nodes visited + interactions) of each body's recent force evaluations, by body index
+    std::vector<float> bodyWork;
+    // (hilbert key, position in the particles) of every body in the current force evaluation, sorted
+    std::vector<std::pair<uint64_t, uint32_t>> curveOrder;
+    std::vector<double> workPrefix; // work of curveOrder[0, k)
+
+    std::unique_ptr<integrator> integrate;
+    // bodies being advanced by the current step, where they started and their contiguous copy
+    std::vector<body*> active;
+    std::vector<point> startPos;
+    particles state;
+    std::vector<strippedBody> leavers;
+
+    // takes a body out of the tree and the body index, its node is left behind empty
+    strippedBody _removeStar(body* b);
+
+    // width of the periodic box, 0 while the domain is open
+    double period() { return periodic ? root->bounds.ur.x - root->bounds.ll.x : 0; }
+    // to - from, between the nearest periodic images of the two if period isnt 0
+    static point separation(point from, point to, double period) {
+        point d = {to.x - from.x, to.y - from.y};
+        if (period > 0) {
+            d.x -= period * std::round(d.x / period);
+            d.y -= period * std::round(d.y / period);
         }
+        return d;
     }
-    void drawBlackHole(point p, GLubyte* color) {
-        pointi c = toRenderGridCoords(p);
-        if (c.x < 0 || c.x >= width || c.y < 0 || c.y >= height) return;
-
-        // ez
-        drawPixel(3 * ((c.y + 2) * width + c.x), color);
-        drawPixel(3 * ((c.y - 2) * width + c.x), color);
-        drawPixel(3 * (c.y * width + c.x + 2), color);
-        drawPixel(3 * (c.y * width + c.x - 2), color);
-
-        drawPixel(3 * ((c.y + 1) * width + c.x - 1), color);
-        drawPixel(3 * ((c.y + 1) * width + c.x + 1), color);
-        drawPixel(3 * ((c.y - 1) * width + c.x - 1), color);
-        drawPixel(3 * ((c.y - 1) * width + c.x + 1), color);
+    // squared distance from p to the nearest periodic image of q (q is at most one period wide), 0 if p is inside
+    static double distanceSquared(const quad& q, point p, double period) {
+        if (period == 0) return q.distanceSquared(p);
+
+        double d2 = 0;
+        for (int k = 0; k < 2; k++) {
+            double half = (q.ur[k] - q.ll[k]) / 2.0;
+            double d = p[k] - (q.ll[k] + half);
+            d -= period * std::round(d / period);
+            d = std::max(std::fabs(d) - half, 0.0);
+            d2 += d * d;
+        }
+        return d2;
     }
 
-    void drawCross(point p, GLubyte* color) {
-        pointi c = toRenderGridCoords(p);
-        if (c.x < 0 || c.x >= width || c.y < 0 || c.y >= height) return;
-
-        drawPixel(3 * (c.y * width + c.x), color);
-        drawPixel(3 * ((c.y + 1) * width + c.x), color);
-        drawPixel(3 * ((c.y - 1) * width + c.x), color);
-        drawPixel(3 * (c.y * width + c.x + 1), color);
-        drawPixel(3 * (c.y * width + c.x - 1), color);
+    // p moved back into the root by whole multiples of its width
+    point wrap(point p) {
+        for (int k = 0; k < 2; k++) {
+            double size = root->bounds.ur[k] - root->bounds.ll[k];
+            p[k] -= size * std::floor((p[k] - root->bounds.ll[k]) / size);
+        }
+        return p;
     }
 
-    void drawBody(body* b) {
-        // these dont match reality at all but /shrug
-        if (b->mass >= 10e3) drawBlackHole(b->pos, red);
-        else if (b->mass > 149.8) drawCross(b->pos, stellar[6]);
-        else if (b->mass > 149.5) drawCross(b->pos, stellar[5]);
-        else if (b->mass > 140) drawPixel(b->pos, stellar[4]);
-        else if (b->mass > 100) drawPixel(b->pos, stellar[3]);
-        else if (b->mass > 70) drawPixel(b->pos, stellar[2]);
-        else if (b->mass > 20) drawPixel(b->pos, stellar[1]);
-        else drawPixel(b->pos, stellar[0]);
+    // doubles the root towards toward, the old root is kept as one of the new children
+    void growRoot(point toward);
+    // drops root levels that only have one non empty child
+    void shrinkRoot();
+
+    // merges every pair of bodies closer than the sum of their radii
+    void resolveCollisions();
+    double collisionRadius(double mass) { return collisionScale * std::cbrt(mass); }
+
+    // unlocked versions of the public queries, foreach is called with every leaf body that matches
+    void _queryRange(quad range, const std::function<void(body*)>& foreach);
+    void _queryRadius(point p, double r, const std::function<void(body*)>& foreach);
+
+    // debug overlay drawing, everything is clipped to the screen
+    // draw a horizontal run of pixels from x0 to x1 (inclusive), assuming color is a pointer to GLubyte array of at least size 3
+    void drawSpan(int y, int x0, int x1, GLubyte* color);
+    void drawColumn(int x, int y0, int y1, GLubyte* color);
+    void drawOutline(quad q, GLubyte* color) {
+        pointi ll = toRenderGridCoords(q.ll);
+        pointi ur = toRenderGridCoords(q.ur);
+
+        drawSpan(ll.y, ll.x, ur.x, color);
+        drawSpan(ur.y, ll.x, ur.x, color);
+        drawColumn(ll.x, ll.y, ur.y, color);
+        drawColumn(ur.x, ll.y, ur.y, color);
     }
+    void drawSquare(point p, int r, GLubyte* color) {
+        pointi c = toRenderGridCoords(p);
+        int hr = r / 2;
 
-    void hideBody(body* b) {
-        if (b->mass >= 10e3) drawBlackHole(b->pos, black);
-        else if (b->mass >= 145) drawCross(b->pos, black);
-        else drawPixel(b->pos, black);
+        for (int y = c.y - hr; y < c.y + hr; y++) drawSpan(y, c.x - hr, c.x + hr - 1, color);
     }
 
     void registerToBodyIndex(body* b, bool verify = true) {
         if (verify) {
-            size_t s = registeredBodies.capacity();
+            size_t s = registeredBodies.size();
             // resize because we use operator[] to access - reserve does not immediantely increase size of array
             if (b->index >= s) registeredBodies.resize((size_t) b->index * 2);
         }
 
         registeredBodies[b->index] = b;
+
+        // first time this index is placed, it is stored at the end until the next reorder
+        if ((size_t) b->index >= slotOf.size()) slotOf.resize(registeredBodies.size(), -1);
+        if (slotOf[b->index] < 0) {
+            slotOf[b->index] = (int) storage.size();
+            storage.push_back(b->index);
+        }
     }
+
+    // body indices in the order step lays their state out in memory (see reorderInterval), indices stay the only id
+    // a body has so nothing outside needs to know about this. dead indices are skipped until the next reorder drops them
+    std::vector<int> storage;
+    std::vector<int> slotOf; // position of every body index in storage, -1 if it isnt there
+    int stepsSinceReorder = 0;
+    // puts storage into the curve order of the last force evaluation, called between advance and scatter
+    void reorderStorage();
 public:
     GLubyte* renderWindow = nullptr;
-    Universe(int width, int height, double trueWidth) : width(width), height(height) {
-        lengthPerPixel = trueWidth / width;
+    Universe(int width, int height, double trueWidth) : width(width), height(height), lodThreshold(0), trackConserved(false), collisions(false), shrinkDomain(false), periodic(false) {
+        double lengthPerPixel = trueWidth / width;
+        view = {{width * lengthPerPixel / 2.0, height * lengthPerPixel / 2.0}, lengthPerPixel};
 
         srand(rand() ^ (uint16_t) time(NULL));
 
@@ -151,38 +286,104 @@ public:
         };
 
         registeredBodies.resize(100);
+        integrate.reset(new leapfrog());
 
         resizeWindow(width, height);
     }
 
     void resizeWindow(int width, int height, bool redraw = true);
+    // render thread only, draws the newest published frame
     GLubyte*& snapshot(snapshotConfig config = {});
-    int toRenderGrid(point p) {
-        pointi i = toRenderGridCoords(p);
-        if (i.x < 0 || i.x >= width || i.y < 0 || i.y >= height) return -1;
-        return 3 * (i.x + i.y * width);
+    // last frame consumed by snapshot
+    const renderFrame& frame() { return frames.read(); }
+    // render thread only, if generation() hasnt changed since the last upload nothing needs to be uploaded
+    // otherwise dirty() is what changed relative to generation() - 1
+    uint64_t generation() { return frameGeneration; }
+    dirtyRect dirty() { return lastDirty; }
+    // nodes that project to fewer than this many pixels are published as a single aggregate, 0 to publish every body
+    std::atomic<double> lodThreshold;
+
+    // step() publishes on its own, this is for showing state before the first step or after changing what is published
+    void publishFrame() {
+        std::lock_guard<std::mutex> guard(treeLock);
+        _publishFrame();
     }
-    pointi toRenderGridCoords(point p) { return {(int) (p.x / lengthPerPixel), (int) (p.y / lengthPerPixel)}; }
-
-    void registerStar(strippedBody sb) {
-        std::queue<recursionState>* states = new std::queue<recursionState>();
-        recursionState state = {root, sb, true};
-        states->push(state);
-
-        _registerStar(states);
+    pointi toRenderGridCoords(point p) { return view.toScreen(p, width, height); }
 
-        delete states;
+    // ui thread only, bodies are culled against the camera when the next frame is published
+    camera getCamera() { return view; }
+    void setCamera(camera c) {
+        std::lock_guard<std::mutex> guard(viewLock);
+        view = c;
     }
 
+    // positions outside the root grow it to fit (or wrap if periodic), bodies without a finite position are skipped
+    void registerStar(strippedBody sb);
+
     void registerStar(point pos, double mass, point vel = {0, 0}) {
         registerStar({mass, pos, {{0, 0}, {0, 0}}, vel, bodyIndex++});
     }
 
-    void traverse(const std::function<bool(body*, int)>& foreach) { _traverse(root, foreach, 0); }
+    // s/d threshold below which a node is treated as a single body
+    double openingAngle = body::DELTA;
+    double timeStep = 0.0025; // if inner ring starts pulsating in and out, decrease
+    // every this many steps the bodies are laid out again along a hilbert curve, so bodies next to each other in the
+    // particle arrays are also close in the tree, 0 keeps them in the order they were added
+    int reorderInterval = 32;
+
+    // takes effect from the next step, defaults to leapfrog
+    void setIntegrator(std::unique_ptr<integrator> i);
+
+    // accumulate conservedQuantities during step (only valid while enabled), results are published with each frame
+    std::atomic<bool> trackConserved;
+    // merge bodies that touch at the end of every step, their radius is collisionScale * cbrt(mass)
+    std::atomic<bool> collisions;
+    double collisionScale = 0.01;
+    // the root grows whenever a body leaves it, with this it is also cut back down to what is occupied after each step
+    std::atomic<bool> shrinkDomain;
+    // the root becomes a periodic box, bodies that leave it wrap around and forces include every periodic image
+    // collisions, queries and validateForces all measure separations between nearest images too
+    std::atomic<bool> periodic;
+    conservedQuantities conserved;
+
+    void traverse(const std::function<bool(body*, int)>& foreach) {
+        std::lock_guard<std::mutex> guard(treeLock);
+        _traverse(root, foreach, 0);
+    }
     void step();
 
+    // compares tree forces against exact direct summation, once per opening angle
+    std::vector<forceErrorReport> validateForces(const std::vector<double>& angles);
+
     void registerGalaxy(point center, int amt, double coreMass, point coreVel, point radius);
 
+    // body indices found through the tree, in no particular order
+    std::vector<int> queryRange(quad range);
+    std::vector<int> queryRadius(point p, double r);
+    // k closest bodies to p, closest first
+    std::vector<int> queryNearest(point p, int k);
+
+    // copy of every body currently in the simulation, ordered by index
+    void exportBodies(std::vector<strippedBody>& out);
+    // same, along with the root bounds and the next index to hand out as of the same instant
+    void exportBodies(std::vector<strippedBody>& out, quad& bounds, int& nextIndex);
+
+    // takes every body that leave returns true for out of the simulation
+    std::vector<strippedBody> releaseStars(const std::function<bool(const strippedBody&)>& leave);
+    // adds bodies from another universe, they keep their index (and what their force evaluations cost, if given)
+    void adoptStars(const std::vector<strippedBody>& stars, const std::vector<float>& work = {});
+    // what the force walk of a body has recently cost (nodes visited + interactions), 0 if it hasnt had one here
+    double work(int index);
+    // the tree cut down to nodes that can each be used as a single body from anywhere in region (at openingAngle)
+    void essentialNodes(quad region, std::vector<pointMass>& out);
+    // masses that are not in this universe but still pull on its bodies, e.g. the trees of other ranks (see distributed.h)
+    void setExternalMasses(std::vector<pointMass> masses);
+
+    // bodies are copied immediately, the file itself is written in the background
+    void saveCheckpoint(const std::string& path);
+    // replaces every body currently in the simulation
+    bool loadCheckpoint(const std::string& path);
+
     Universe(Universe const&) = delete;
     Universe& operator=(const Universe&) = delete;
 